@@ -0,0 +1,253 @@
+#define SAFMAT_OUT_OSTREAM 1
+#define SAFMAT_BINLOG 1
+#define SAFMAT_OUT_SYSLOG 1
+#define SAFMAT_OUT_PREFIX 1
+#define SAFMAT_OUT_TEE 1
+#include <fstream>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "safmat.hpp"
+
+// Discards everything, so only the formatting itself is measured.
+struct NullSink {};
+
+template<>
+struct safmat::io::OutputAdapter<NullSink> {
+    inline static void write(NullSink *, std::string_view) {}
+};
+
+template<class F>
+static void bench(std::string_view name, std::size_t iters, F f) {
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < iters; ++i)
+        f(i);
+    const std::chrono::duration<double, std::nano> dt = std::chrono::steady_clock::now() - start;
+    safmat::println("{:<48} {:>10.1f} ns/op", name, dt.count() / iters);
+}
+
+// Runs f in nthreads threads at once and reports the wall time per operation.
+template<class F>
+static void bench_mt(std::string_view name, std::size_t nthreads, std::size_t iters, F f) {
+    std::vector<std::thread> threads{};
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t t = 0; t < nthreads; ++t) {
+        threads.emplace_back([&f, iters] {
+            for (std::size_t i = 0; i < iters; ++i)
+                f(i);
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+    const std::chrono::duration<double, std::nano> dt = std::chrono::steady_clock::now() - start;
+    safmat::println("{:<48} {:>10.1f} ns/op", safmat::format("{} ({} threads)", name, nthreads), dt.count() / (iters * nthreads));
+}
+
+int main() {
+    constexpr std::size_t N = 1'000'000;
+    NullSink sink{};
+
+    {
+        // All threads log into the same Output.
+        const safmat::Output out{sink};
+        const auto f = [&out](std::size_t i) {
+            safmat::println(out, "[{:>8}] {} {:08x} {}", i, "request done", i * 7, 12.5);
+        };
+
+        bench("shared Output", N, f);
+        for (std::size_t n : { 2, 4, 8 })
+            bench_mt("shared Output", n, N / n, f);
+    }
+
+    {
+        // Three outputs, formatted three times vs. once.
+        NullSink a{}, b{}, c{};
+        safmat::io::Tee tee{ { a }, { b }, { c } };
+
+        bench("println() to 3 outputs", N, [&a, &b, &c](std::size_t i) {
+            safmat::println(a, "[{:>8}] {} {:08x} {}", i, "request done", i * 7, 12.5);
+            safmat::println(b, "[{:>8}] {} {:08x} {}", i, "request done", i * 7, 12.5);
+            safmat::println(c, "[{:>8}] {} {:08x} {}", i, "request done", i * 7, 12.5);
+        });
+        bench("Tee::println() to 3 outputs", N, [&tee](std::size_t i) {
+            tee.println(0, "[{:>8}] {} {:08x} {}", i, "request done", i * 7, 12.5);
+        });
+    }
+
+    {
+        // Prefixing every line with a separately formatted prefix vs. PrefixFilter.
+        const safmat::Output out{sink};
+        safmat::io::PrefixFilter filter{out, "{time} [{thread}] {component}: "};
+        safmat::io::PrefixFilter::set_component("http");
+
+        bench("format() prefix + println()", N, [&out](std::size_t i) {
+            const auto now = std::chrono::system_clock::now().time_since_epoch();
+            const auto prefix = safmat::format("{} [{}] {}: ", std::chrono::duration_cast<std::chrono::microseconds>(now).count(), ::gettid(), "http");
+            safmat::println(out, "{}[{:>8}] {} {}", prefix, i, "request done", 200);
+        });
+        bench("println(PrefixFilter &)", N, [&filter](std::size_t i) {
+            safmat::println(filter, "[{:>8}] {} {}", i, "request done", 200);
+        });
+    }
+
+    {
+        // Realistic integer distributions: HTTP status codes, ports and (mostly small) counters.
+        std::vector<unsigned> values(4096);
+        std::uint64_t seed = 42;
+        const auto rand = [&seed] { return static_cast<unsigned>((seed = seed * 6364136223846793005u + 1442695040888963407u) >> 33); };
+        const unsigned statuses[] = { 200, 200, 200, 204, 301, 304, 404, 500 };
+        for (std::size_t i = 0; i < values.size(); ++i) {
+            switch (i % 3) {
+            case 0: values[i] = statuses[rand() % 8]; break;
+            case 1: values[i] = rand() % 65536; break;
+            default: values[i] = rand() % 16 == 0 ? rand() : rand() % 1000; break;
+            }
+        }
+
+        char buf[16];
+        volatile char sink_char{};
+        bench("std::to_chars() on realistic integers", N, [&](std::size_t i) {
+            sink_char = *std::to_chars(buf, buf + sizeof buf, values[i % values.size()]).ptr;
+        });
+        bench("internal::to_decimal() on realistic integers", N, [&](std::size_t i) {
+            sink_char = *safmat::internal::to_decimal(buf, buf + sizeof buf, values[i % values.size()]);
+        });
+
+        std::string str{};
+        bench("format_to() of 4 realistic integers", N, [&](std::size_t i) {
+            str.clear();
+            safmat::format_to(str, "{} {} {} {}", values[i % 4096], values[(i + 1) % 4096], values[(i + 2) % 4096], values[(i + 3) % 4096]);
+        });
+    }
+
+    {
+        // Base-36 IDs: encoded into a temporary in a separate pass vs. inline with {:r36}.
+        std::string str{};
+        const auto base36 = [](std::uint64_t x) {
+            std::string s{};
+            do {
+                s += "0123456789abcdefghijklmnopqrstuvwxyz"[x % 36];
+                x /= 36;
+            } while (x != 0);
+            std::reverse(s.begin(), s.end());
+            return s;
+        };
+
+        bench("format_to() of a base-36 temporary", N, [&str, &base36](std::size_t i) {
+            str.clear();
+            safmat::format_to(str, "id={}", base36(i * 0x9e3779b97f4a7c15u));
+        });
+        bench("format_to() with {:r36}", N, [&str](std::size_t i) {
+            str.clear();
+            safmat::format_to(str, "id={:r36}", i * 0x9e3779b97f4a7c15u);
+        });
+    }
+
+#ifdef __SIZEOF_INT128__
+    {
+        // 128-bit IDs, most of which need more than 64 bits.
+        std::string str{};
+        const auto id = [](std::size_t i) { return (static_cast<unsigned __int128>(i) << 70) * 0x9e3779b97f4a7c15u + i; };
+
+        bench("format_to() of a 64-bit integer", N, [&str](std::size_t i) {
+            str.clear();
+            safmat::format_to(str, "{}", static_cast<std::uint64_t>(i) * 0x9e3779b97f4a7c15u);
+        });
+        bench("format_to() of a 128-bit integer", N, [&str, &id](std::size_t i) {
+            str.clear();
+            safmat::format_to(str, "{}", id(i));
+        });
+        bench("format_to() of a 128-bit integer as hex", N, [&str, &id](std::size_t i) {
+            str.clear();
+            safmat::format_to(str, "{:x}", id(i));
+        });
+    }
+#endif
+
+    {
+        std::string str{};
+        const auto fmt = "key={} value={} status={} path={}";
+
+        bench("std::string via type-erased Output", N, [&str, fmt](std::size_t i) {
+            str.clear();
+            safmat::format_to(safmat::Output{str}, fmt, i, "some value", 200, "/index.html");
+        });
+        bench("std::string via OutputAdapter<std::string>", N, [&str, fmt](std::size_t i) {
+            str.clear();
+            safmat::format_to(str, fmt, i, "some value", 200, "/index.html");
+        });
+    }
+
+    {
+        std::ofstream ofs{"/dev/null"};
+        std::ostream &os = ofs;
+        FILE *file = std::fopen("/dev/null", "w");
+
+        bench("println(std::ostream &)", N, [&os](std::size_t i) {
+            safmat::println(os, "[{}] {} {} {}", i, "GET", "/index.html", 200);
+        });
+        bench("println(FILE *)", N, [file](std::size_t i) {
+            safmat::println(file, "[{}] {} {} {}", i, "GET", "/index.html", 200);
+        });
+
+        safmat::binlog::Writer writer{file};
+        bench("binlog::Writer::log()", N, [&writer](std::size_t i) {
+            writer.log("[{}] {} {} {}", i, "GET", "/index.html", 200);
+        });
+
+        std::fclose(file);
+    }
+
+#if SAFMAT_OUT_ZLIB
+    {
+        // Compressing while formatting vs. formatting to a file and compressing it with gzip(1) afterwards.
+        const auto line = [](auto &out, std::size_t i) {
+            safmat::println(out, "{},{},{:.3f},{}", i, "export-row", i * 0.25, i % 7 == 0 ? "flagged" : "ok");
+        };
+
+        FILE *file = std::fopen("/tmp/safmat-bench.csv", "w");
+        const auto start = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < N; ++i)
+            line(file, i);
+        std::fclose(file);
+        if (std::system("gzip -f /tmp/safmat-bench.csv") != 0)
+            safmat::println("gzip(1) failed");
+        const std::chrono::duration<double, std::nano> dt = std::chrono::steady_clock::now() - start;
+        safmat::println("{:<48} {:>10.1f} ns/op", "println(FILE *) + gzip(1)", dt.count() / N);
+
+        file = std::fopen("/tmp/safmat-bench.csv.gz", "w");
+        {
+            safmat::io::GzipWriter writer{file};
+            bench("println(GzipWriter &)", N, [&writer, &line](std::size_t i) {
+                line(writer, i);
+            });
+        }
+        std::fclose(file);
+        std::remove("/tmp/safmat-bench.csv.gz");
+    }
+#endif
+
+    {
+        // A reader thread drains the other end of the socket pair, like a syslog daemon would.
+        int sv[2];
+        ::socketpair(AF_UNIX, SOCK_DGRAM, 0, sv);
+        std::thread reader{[fd = sv[1]] {
+            char buf[1024];
+            while (::recv(fd, buf, sizeof buf, 0) > 0);
+        }};
+
+        for (std::size_t batch : { 1, 64 }) {
+            safmat::io::SyslogSink syslog{sv[0], "bench"};
+            syslog.batch_size = batch;
+            bench(safmat::format("println(SyslogSink &) batch={}", batch), N / 4, [&syslog](std::size_t i) {
+                safmat::println(syslog, "[{}] {} {} {}", i, "GET", "/index.html", 200);
+            });
+        }
+
+        // An empty datagram stops the reader.
+        ::send(sv[0], "", 0, 0);
+        ::close(sv[0]);
+        reader.join();
+        ::close(sv[1]);
+    }
+}
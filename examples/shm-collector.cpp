@@ -0,0 +1,73 @@
+// Forks worker processes, which println() into a shared-memory ring,
+// while this process collects their lines into a file with large writes.
+// Usage: shm-collector [OUTPUT [WORKERS [LINES]]]
+#define SAFMAT_OUT_SHM 1
+#include <sys/wait.h>
+#include <system_error>
+#include <cstdlib>
+#include <string>
+#include "../safmat.hpp"
+
+static void worker(safmat::io::ShmRing &ring, int id, int lines) {
+    for (int i = 0; i < lines; ++i)
+        safmat::println(ring, "worker {:>2} pid {} line {:>8}", id, ::getpid(), i);
+}
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : "/dev/stdout";
+    const int nworkers = argc > 2 ? std::atoi(argv[2]) : 4;
+    const int nlines = argc > 3 ? std::atoi(argv[3]) : 100'000;
+
+    try {
+        safmat::io::ShmRing ring{std::size_t{8} << 20};
+
+        for (int i = 0; i < nworkers; ++i) {
+            const pid_t pid = ::fork();
+            if (pid < 0)
+                throw std::system_error{errno, std::generic_category(), "fork()"};
+            if (pid == 0) {
+                worker(ring, i, nlines);
+                std::_Exit(0);
+            }
+        }
+
+        const int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+            throw std::system_error{errno, std::generic_category(), path};
+
+        std::string buf{};
+        std::size_t total{0}, writes{0};
+        const auto flush = [&] {
+            for (std::string_view s = buf; !s.empty(); ) {
+                const auto n = ::write(fd, s.data(), s.size());
+                if (n < 0)
+                    throw std::system_error{errno, std::generic_category(), "write()"};
+                s.remove_prefix(n);
+            }
+            total += buf.size();
+            ++writes;
+            buf.clear();
+        };
+
+        for (int running = nworkers; running > 0; ) {
+            if (ring.read(buf) == 0)
+                ::usleep(1000);
+            if (buf.size() >= (std::size_t{1} << 20))
+                flush();
+            while (running > 0 && ::waitpid(-1, nullptr, WNOHANG) > 0)
+                --running;
+        }
+
+        // All workers have exited, so a line, that is still not committed, belongs to a crashed one.
+        ring.stall_timeout = {};
+        ring.read(buf);
+        if (!buf.empty())
+            flush();
+        ::close(fd);
+
+        safmat::println(stderr, "collected {} bytes in {} writes, {} lines dropped", total, writes, ring.dropped());
+    } catch (const std::exception &e) {
+        safmat::println(stderr, "shm-collector: {}", e.what());
+        return 1;
+    }
+}
@@ -20,25 +20,176 @@
 #include <type_traits>
 #include <functional>
 #include <exception>
+#include <algorithm>
 #include <optional>
+#include <iterator>
 #include <concepts>
 #include <charconv>
 #include <variant>
 #include <utility>
 #include <cstring>
+#include <cstddef>
+#include <cstdint>
 #include <version>
+#include <vector>
 #include <string>
 #include <memory>
+#include <atomic>
 #include <limits>
 #include <cctype>
+#include <mutex>
+#include <tuple>
 #include <cmath>
 #include <array>
 #include <span>
+#include <bit>
 
 #if __cpp_lib_source_location >= 201907L
 # include <source_location>
 #endif
 
+#if __cpp_lib_expected >= 202202L
+# include <expected>
+#endif
+
+#if __cpp_lib_mdspan >= 202207L
+# include <mdspan>
+#endif
+
+// Enable support for POSIX file descriptors (default=enabled, if available).
+#ifndef  SAFMAT_POSIX
+# if __has_include(<unistd.h>)
+#  define SAFMAT_POSIX 1
+# else
+#  define SAFMAT_POSIX 0
+# endif
+#endif
+#if SAFMAT_POSIX
+# include <sys/uio.h>
+# include <unistd.h>
+# include <climits>
+# include <atomic>
+# include <cerrno>
+#endif
+
+// Enable the table of small decimal integers (0-9999) for formatting integers (default=enabled).
+#ifndef  SAFMAT_SMALL_INTS
+# define SAFMAT_SMALL_INTS 1
+#endif
+
+// Enable support for formatting in multiple threads (default=enabled).
+#ifndef  SAFMAT_THREADS
+# define SAFMAT_THREADS 1
+#endif
+#if SAFMAT_THREADS
+# include <condition_variable>
+# include <thread>
+# include <mutex>
+#endif
+
+// Enable support for C++20 coroutines, eg. async_print() (default=enabled, if available).
+#ifndef  SAFMAT_ASYNC
+# if __cpp_impl_coroutine >= 201902L && __has_include(<coroutine>)
+#  define SAFMAT_ASYNC 1
+# else
+#  define SAFMAT_ASYNC 0
+# endif
+#endif
+#if SAFMAT_ASYNC
+# include <coroutine>
+#endif
+
+// Enable support for binary logging (default=disabled).
+#ifndef  SAFMAT_BINLOG
+# define SAFMAT_BINLOG 0
+#endif
+#if SAFMAT_BINLOG
+# include <unordered_map>
+# include <cstdint>
+# include <cstdio>
+# include <mutex>
+#endif
+
+// Enable support for the memory-mapped ring file Output (default=disabled, requires SAFMAT_POSIX).
+#ifndef  SAFMAT_OUT_MMAP
+# define SAFMAT_OUT_MMAP 0
+#endif
+#if SAFMAT_OUT_MMAP
+# include <system_error>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <cstdint>
+# include <fcntl.h>
+# include <atomic>
+#endif
+
+// Enable support for the shared-memory ring Output (default=disabled, requires SAFMAT_POSIX).
+#ifndef  SAFMAT_OUT_SHM
+# define SAFMAT_OUT_SHM 0
+#endif
+#if SAFMAT_OUT_SHM
+# include <system_error>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <cstdint>
+# include <fcntl.h>
+# include <atomic>
+# include <chrono>
+# include <new>
+#endif
+
+// Enable support for the size-based rotating file Output (default=disabled, requires SAFMAT_POSIX and SAFMAT_THREADS).
+#ifndef  SAFMAT_OUT_ROTATING
+# define SAFMAT_OUT_ROTATING 0
+#endif
+#if SAFMAT_OUT_ROTATING
+# include <condition_variable>
+# include <system_error>
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <cstdio>
+# include <chrono>
+# include <mutex>
+#endif
+
+// Enable support for the gzip-compressing Output (default=disabled, requires -lz).
+#ifndef  SAFMAT_OUT_ZLIB
+# define SAFMAT_OUT_ZLIB 0
+#endif
+#if SAFMAT_OUT_ZLIB
+# include <stdexcept>
+# include <zlib.h>
+#endif
+
+// Enable support for the leveled fan-out Output (default=disabled).
+#ifndef  SAFMAT_OUT_TEE
+# define SAFMAT_OUT_TEE 0
+#endif
+
+// Enable support for the line-prefix filter Output (default=disabled).
+#ifndef  SAFMAT_OUT_PREFIX
+# define SAFMAT_OUT_PREFIX 0
+#endif
+#if SAFMAT_OUT_PREFIX
+# include <chrono>
+# include <atomic>
+#endif
+
+// Enable support for the syslog Output over Unix domain sockets (default=disabled, requires SAFMAT_POSIX).
+#ifndef  SAFMAT_OUT_SYSLOG
+# define SAFMAT_OUT_SYSLOG 0
+#endif
+#if SAFMAT_OUT_SYSLOG
+# include <system_error>
+# include <sys/socket.h>
+# include <pthread.h>
+# include <sys/un.h>
+# include <cstdint>
+# include <atomic>
+# include <chrono>
+# include <mutex>
+#endif
+
 // Enable support for std::ostream Output (default=disabled).
 #ifndef  SAFMAT_OUT_OSTREAM
 # define SAFMAT_OUT_OSTREAM 0
@@ -79,37 +230,111 @@ namespace safmat::io {
         OutputAdapter<T>::write(out, s);
     };
 
+    // An OutputAdapter<T> can accept a hint, that about n more bytes are going to be written.
+    template<class T>
+    concept ReservableOutput = OutputConcept<T> && requires (T *out, std::size_t n) {
+        OutputAdapter<T>::reserve(out, n);
+    };
+
+    // An OutputAdapter<T> can tell, whether out is a terminal (eg. to enable styles).
+    template<class T>
+    concept TerminalOutput = OutputConcept<T> && requires (T *out) {
+        { OutputAdapter<T>::is_tty(out) } -> std::convertible_to<bool>;
+    };
+
+    // Type-erased, non-owning reference to an output.
     class Output {
     private:
-        struct OutputBase {
-            virtual ~OutputBase() = default;
-            virtual void write(std::string_view s) const = 0;
+        struct VTable {
+            void (*write)(void *out, std::string_view s);
+            void (*reserve)(void *out, std::size_t n);
+            bool (*is_tty)(void *out);
         };
         template<OutputConcept T>
-        struct OutputImpl : OutputBase {
-            T *out;
-
-            OutputImpl(T *out) noexcept : out(out) {}
-
-            void write(std::string_view s) const override {
-                OutputAdapter<T>::write(out, s);
-            }
+        static constexpr VTable vtable{
+            [](void *out, std::string_view s) { OutputAdapter<T>::write(static_cast<T *>(out), s); },
+            [] {
+                if constexpr (ReservableOutput<T>) {
+                    return +[](void *out, std::size_t n) { OutputAdapter<T>::reserve(static_cast<T *>(out), n); };
+                } else {
+                    return static_cast<void (*)(void *, std::size_t)>(nullptr);
+                }
+            }(),
+            [] {
+                if constexpr (TerminalOutput<T>) {
+                    return +[](void *out) -> bool { return OutputAdapter<T>::is_tty(static_cast<T *>(out)); };
+                } else {
+                    return static_cast<bool (*)(void *)>(nullptr);
+                }
+            }(),
         };
-        std::shared_ptr<const OutputBase> ptr;
+
+        void *out;
+        const VTable *vt;
     public:
-        Output(const Output &) = default;
-        Output(Output &&) = default;
         template<OutputConcept T>
-        Output(T *out) : ptr(std::make_unique<const OutputImpl<T>>(out)) {}
+        Output(T *out) noexcept : out(out), vt(&vtable<T>) {}
         template<OutputConcept T>
-        Output(T &out) : ptr(std::make_unique<const OutputImpl<T>>(&out)) {}
+        Output(T &out) noexcept : Output(&out) {}
 
-        Output &operator=(const Output &) = default;
-        Output &operator=(Output &&) = default;
-
-        void write(std::string_view s) const { ptr->write(s); }
-        void write(char ch) const { ptr->write({ &ch, &ch + 1 }); }
+        void write(std::string_view s) const { vt->write(out, s); }
+        void write(char ch) const { vt->write(out, { &ch, 1 }); }
+        void reserve(std::size_t n) const {
+            if (vt->reserve)
+                vt->reserve(out, n);
+        }
+        bool reservable() const noexcept { return vt->reserve != nullptr; }
+        bool is_tty() const { return vt->is_tty && vt->is_tty(out); }
     };
+
+    // Anything, that can be written to: an Output or an OutputConcept (or a pointer to it).
+    template<class O>
+    concept OutputTarget = std::same_as<std::remove_cvref_t<O>, Output>
+        || OutputConcept<std::remove_cvref_t<O>>
+        || (std::is_pointer_v<std::remove_cvref_t<O>> && OutputConcept<std::remove_pointer_t<std::remove_cvref_t<O>>>);
+
+    // Statically dispatched writes, for when the concrete output type is known.
+    template<OutputConcept T>
+    void write(T *out, std::string_view s) { OutputAdapter<T>::write(out, s); }
+    template<OutputConcept T>
+    void write(T &out, std::string_view s) { OutputAdapter<T>::write(&out, s); }
+    inline void write(const Output &out, std::string_view s) { out.write(s); }
+
+    // An OutputAdapter<T> can define a Guard, which is held for a whole formatting call
+    // (eg. a std::ostream::sentry), instead of doing the same work for every written fragment.
+    template<OutputConcept T>
+    auto guard(T *out) {
+        if constexpr (requires { typename OutputAdapter<T>::Guard; }) {
+            return typename OutputAdapter<T>::Guard{out};
+        } else {
+            return std::monostate{};
+        }
+    }
+    template<OutputConcept T>
+    auto guard(T &out) { return guard(&out); }
+    inline std::monostate guard(const Output &) { return {}; }
+
+    template<OutputConcept T>
+    bool reservable(T *) noexcept { return ReservableOutput<T>; }
+    template<OutputConcept T>
+    bool reservable(T &) noexcept { return ReservableOutput<T>; }
+    inline bool reservable(const Output &out) noexcept { return out.reservable(); }
+
+    template<OutputConcept T>
+    void reserve(T *out, std::size_t n) {
+        if constexpr (ReservableOutput<T>)
+            OutputAdapter<T>::reserve(out, n);
+    }
+    template<OutputConcept T>
+    void reserve(T &out, std::size_t n) { reserve(&out, n); }
+    inline void reserve(const Output &out, std::size_t n) { out.reserve(n); }
+
+    // Grows c geometrically, so repeated hints don't cause quadratic reallocation.
+    template<class C>
+    void grow(C &c, std::size_t n) {
+        if (c.size() + n > c.capacity())
+            c.reserve(std::max(c.size() + n, 2 * c.capacity()));
+    }
 }
 
 namespace safmat {
@@ -125,25 +350,57 @@ namespace safmat {
         fmt.format_to(ctx, x);
     };
 
-    class FormatArg {
-    private:
+    namespace internal {
         struct FormatArgBase {
             virtual ~FormatArgBase() = default;
             virtual void parse(InputIterator &) = 0;
             virtual void format_to(FormatContext &) = 0;
+            virtual bool format_step(FormatContext &) = 0;
             virtual void reset_fmt() = 0;
             virtual std::optional<std::size_t> to_size_t() const noexcept = 0;
         };
-        template<Formattable T>
+
+        // A Formatter<T> with a Cursor can also format x piecewise (eg. one element of a container at a time):
+        // format_step(ctx, x, cursor) is called until it returns true.
+        template<class F>
+        struct CursorOf {
+            using type = std::monostate;
+        };
+        template<class F> requires requires { typename F::Cursor; }
+        struct CursorOf<F> {
+            using type = typename F::Cursor;
+        };
+
+        // Storage is either T (owned by a FormatArg) or const T & (an argument of basic_format_to(),
+        // which lives on its stack until the end of the call).
+        template<Formattable T, class Storage>
         struct FormatArgImpl : FormatArgBase {
+            using Cursor = typename CursorOf<Formatter<T>>::type;
+
             Formatter<T> fmt{};
-            T value;
+            Storage value;
+            [[no_unique_address]] Cursor cursor{};
 
-            FormatArgImpl(T value) : value(std::move(value)) {}
+            template<class U>
+            FormatArgImpl(U &&value) : value(std::forward<U>(value)) {}
 
             void parse(InputIterator &in) override { fmt.parse(in); }
             void format_to(FormatContext &ctx) override { fmt.format_to(ctx, value); }
-            void reset_fmt() override { fmt = Formatter<T>{}; }
+            bool format_step(FormatContext &ctx) override {
+                if constexpr (std::same_as<Cursor, std::monostate>) {
+                    fmt.format_to(ctx, value);
+                    return true;
+                } else {
+                    if (!fmt.format_step(ctx, value, cursor))
+                        return false;
+                    cursor = Cursor{};
+                    return true;
+                }
+            }
+            void reset_fmt() override {
+                fmt = Formatter<T>{};
+                cursor = Cursor{};
+            }
             std::optional<std::size_t> to_size_t() const noexcept override {
                 if constexpr (std::integral<T>) {
                     return std::size_t(value);
@@ -153,21 +410,41 @@ namespace safmat {
             }
         };
 
-        std::unique_ptr<FormatArgBase> ptr;
+        template<class T>
+        using FormatArgRef = FormatArgImpl<T, const T &>;
+
+        // Only internal code can make a FormatArg, that references its argument.
+        struct FormatArgRefKey {
+            explicit FormatArgRefKey() = default;
+        };
+    }
+
+    class FormatArg {
+    private:
+        std::unique_ptr<internal::FormatArgBase> owned{};
+        internal::FormatArgBase *ptr;
     public:
+        // The argument is copied (or moved) into the FormatArg.
         template<Formattable T>
-        FormatArg(T x) : ptr(std::make_unique<FormatArgImpl<T>>(std::move(x))) {}
-        FormatArg(FormatArg &&) = default;
+        FormatArg(T x) : owned(std::make_unique<internal::FormatArgImpl<T, T>>(std::move(x))), ptr(owned.get()) {}
+        // References arg, which must outlive the FormatArg.
+        FormatArg(internal::FormatArgBase &arg, internal::FormatArgRefKey) noexcept : ptr(&arg) {}
+        FormatArg(FormatArg &&a) noexcept : owned(std::move(a.owned)), ptr(std::exchange(a.ptr, nullptr)) {}
 
-        FormatArg &operator=(FormatArg &&) = default;
+        FormatArg &operator=(FormatArg &&a) noexcept {
+            owned = std::move(a.owned);
+            ptr = std::exchange(a.ptr, nullptr);
+            return *this;
+        }
         template<Formattable T>
         FormatArg &operator=(T x) {
-            ptr = std::make_unique<FormatArgImpl<T>>(std::move(x));
-            return *this;
+            return *this = FormatArg{std::move(x)};
         }
 
         void parse(InputIterator &in) const { ptr->parse(in); }
         void format_to(FormatContext &ctx) const { ptr->format_to(ctx); }
+        // Formats the next piece of the argument (see internal::CursorOf) and returns true, when it's complete.
+        bool format_step(FormatContext &ctx) const { return ptr->format_step(ctx); }
         void reset_fmt() const { ptr->reset_fmt(); }
         std::optional<std::size_t> to_size_t() const noexcept { return ptr->to_size_t(); }
         std::size_t expect_size_t() const {
@@ -189,8 +466,9 @@ namespace safmat {
         }
      };
 
-     inline void xformat_to(FormatContext &ctx, std::string_view fmt) {
-        auto &out = ctx.out;
+     // Literal text is passed to write(), arguments are formatted into ctx.out.
+     template<class W>
+     void basic_xformat_to(FormatContext &ctx, std::string_view fmt, W write) {
         auto it = begin(fmt);
 
         while (it != end(fmt)) {
@@ -199,7 +477,7 @@ namespace safmat {
 
                 if (*it == '{') {
                     ++it;
-                    out.write('{');
+                    write("{");
                     continue;
                 }
 
@@ -231,33 +509,77 @@ namespace safmat {
                 ++it;
                 if (*it == '}') {
                     ++it;
-                    out.write('}');
+                    write("}");
                 } else {
                     throw format_error("'}' must be escaped with '}'.");
                 }
             } else {
-                out.write(*it++);
+                // Write runs of literal text at once.
+                const auto start = it;
+                while (it != end(fmt) && *it != '{' && *it != '}')
+                    ++it;
+                write(std::string_view{start, it});
             }
         }
     }
 
-    template<class... Args>
-    void format_to(Output out, std::string_view fmt, Args&&... args) {
-        std::array<FormatArg, sizeof...(args)> argv{ FormatArg{ std::forward<Args>(args) }... };
-        auto ctx = FormatContext{ out, argv, 0 };
-        xformat_to(ctx, fmt);
+    inline void xformat_to(FormatContext &ctx, std::string_view fmt) {
+        basic_xformat_to(ctx, fmt, [&out = ctx.out](std::string_view s) { out.write(s); });
+    }
+
+    namespace internal {
+        // Rough estimate of the formatted length of x, used as a hint for reserving output space.
+        template<class T>
+        std::size_t estimate_size(const T &x) {
+            if constexpr (std::is_convertible_v<const T &, std::string_view>) {
+                return std::string_view{x}.size();
+            } else if constexpr (std::integral<T>) {
+                return std::numeric_limits<T>::digits10 + 2;
+            } else if constexpr (std::floating_point<T>) {
+                return std::numeric_limits<T>::max_digits10 + 8;
+            } else if constexpr (requires { std::size(x); }) {
+                return std::size(x) * 8 + 2;
+            } else {
+                return 16;
+            }
+        }
+    }
+
+    // Formats fmt into out, followed by end (eg. "\n" for println()).
+    // If the type of out is statically known, the literal text of fmt is written without going through Output.
+    // Arguments are always formatted through the type-erased Output.
+    template<io::OutputTarget O, class... Args>
+    void basic_format_to(O &out, std::string_view fmt, std::string_view end, Args&&... args) {
+        [[maybe_unused]] const auto guard = io::guard(out);
+        if (io::reservable(out))
+            io::reserve(out, fmt.size() + end.size() + (std::size_t{0} + ... + internal::estimate_size(args)));
+        // The arguments live until the end of the call, so they are referenced, instead of copied to the heap.
+        std::tuple<internal::FormatArgRef<std::remove_cvref_t<Args>>...> refs{ args... };
+        auto argv = std::apply([](auto &...r) {
+            return std::array<FormatArg, sizeof...(Args)>{ FormatArg{ r, internal::FormatArgRefKey{} }... };
+        }, refs);
+        const Output erased{out};
+        auto ctx = FormatContext{ erased, argv, 0 };
+        basic_xformat_to(ctx, fmt, [&out](std::string_view s) { io::write(out, s); });
+
+        if (!end.empty())
+            io::write(out, end);
+    }
+
+    template<io::OutputTarget O, class... Args>
+    void format_to(O &&out, std::string_view fmt, Args&&... args) {
+        basic_format_to(out, fmt, {}, std::forward<Args>(args)...);
     }
 
     template<class... Args>
     std::string format(std::string_view fmt, Args&&... args) {
         std::string str{};
-        Output out{str};
-        format_to(out, fmt, std::forward<Args>(args)...);
+        format_to(str, fmt, std::forward<Args>(args)...);
         return str;
     }
 
-    template<class... Args>
-    void print(Output out, std::string_view fmt, Args&&... args) {
+    template<io::OutputTarget O, class... Args>
+    void print(O &&out, std::string_view fmt, Args&&... args) {
         format_to(out, fmt, std::forward<Args>(args)...);
     }
 
@@ -266,10 +588,9 @@ namespace safmat {
         print(stdout, fmt, std::forward<Args>(args)...);
     }
 
-    template<class... Args>
-    void println(Output out, std::string_view fmt, Args&&... args) {
-        format_to(out, fmt, std::forward<Args>(args)...);
-        out.write('\n');
+    template<io::OutputTarget O, class... Args>
+    void println(O &&out, std::string_view fmt, Args&&... args) {
+        basic_format_to(out, fmt, "\n", std::forward<Args>(args)...);
     }
 
     template<class... Args>
@@ -282,16 +603,256 @@ namespace safmat {
 namespace safmat::io {
     template<>
     struct OutputAdapter<std::string> {
+        inline static void reserve(std::string *out, std::size_t n) {
+            grow(*out, n);
+        }
         inline static void write(std::string *out, std::string_view s) {
             *out += s;
         }
     };
 
+    // Byte buffers, eg. for network serialization.
+    template<class B> requires (std::same_as<B, char> || std::same_as<B, unsigned char> || std::same_as<B, std::byte>)
+    struct OutputAdapter<std::vector<B>> {
+        inline static void reserve(std::vector<B> *out, std::size_t n) {
+            grow(*out, n);
+        }
+        inline static void write(std::vector<B> *out, std::string_view s) {
+            const auto data = reinterpret_cast<const B *>(s.data());
+            out->insert(out->end(), data, data + s.size());
+        }
+    };
+
+    // Counts the written bytes, without storing them.
+    struct Counter {
+        std::size_t count{0};
+    };
+
+    template<>
+    struct OutputAdapter<Counter> {
+        inline static void write(Counter *out, std::string_view s) {
+            out->count += s.size();
+        }
+    };
+
+    // Output buffer of linked fixed-size blocks.
+    // Written bytes are never moved, so very large outputs don't need to be reallocated and copied.
+    // The buffer can be iterated as std::string_view chunks and written with a single writev().
+    class ChunkedBuffer {
+    public:
+        static constexpr std::size_t block_size = 64 * 1024;
+    private:
+        struct Block {
+            std::unique_ptr<Block> next{};
+            std::size_t size{0};
+            char data[block_size];
+        };
+
+        std::unique_ptr<Block> head{};
+        Block *tail{nullptr};
+        std::unique_ptr<Block> pool{};
+        std::size_t total{0};
+
+        std::unique_ptr<Block> alloc() {
+            if (!pool)
+                return std::make_unique<Block>();
+
+            auto b = std::move(pool);
+            pool = std::move(b->next);
+            b->size = 0;
+            return b;
+        }
+
+        // Destroys the blocks iteratively, instead of recursively through Block::next.
+        void release() noexcept {
+            for (auto *list : { &head, &pool }) {
+                while (*list)
+                    *list = std::move((*list)->next);
+            }
+        }
+    public:
+        class iterator {
+        private:
+            const Block *b;
+        public:
+            using value_type = std::string_view;
+            using difference_type = std::ptrdiff_t;
+
+            iterator(const Block *b = nullptr) noexcept : b(b) {}
+
+            std::string_view operator*() const noexcept { return { b->data, b->size }; }
+            iterator &operator++() noexcept { b = b->next.get(); return *this; }
+            iterator operator++(int) noexcept { auto tmp = *this; ++*this; return tmp; }
+            bool operator==(const iterator &) const = default;
+        };
+
+        ChunkedBuffer() = default;
+        // The moved-from buffer is empty.
+        ChunkedBuffer(ChunkedBuffer &&other) noexcept
+            : head{std::move(other.head)}, tail{std::exchange(other.tail, nullptr)},
+              pool{std::move(other.pool)}, total{std::exchange(other.total, 0)} {}
+
+        ChunkedBuffer &operator=(ChunkedBuffer &&other) noexcept {
+            if (this != &other) {
+                release();
+                head = std::move(other.head);
+                tail = std::exchange(other.tail, nullptr);
+                pool = std::move(other.pool);
+                total = std::exchange(other.total, 0);
+            }
+            return *this;
+        }
+
+        ~ChunkedBuffer() {
+            release();
+        }
+
+        void write(std::string_view s) {
+            total += s.size();
+            while (!s.empty()) {
+                if (!tail || tail->size == block_size) {
+                    auto b = alloc();
+                    const auto next = b.get();
+                    (tail ? tail->next : head) = std::move(b);
+                    tail = next;
+                }
+
+                const auto n = std::min(s.size(), block_size - tail->size);
+                std::memcpy(tail->data + tail->size, s.data(), n);
+                tail->size += n;
+                s.remove_prefix(n);
+            }
+        }
+
+        // Keeps the blocks for reuse.
+        void clear() noexcept {
+            if (tail) {
+                tail->next = std::move(pool);
+                pool = std::move(head);
+                tail = nullptr;
+            }
+            total = 0;
+        }
+
+        std::size_t size() const noexcept { return total; }
+        bool empty() const noexcept { return total == 0; }
+
+        iterator begin() const noexcept { return { head.get() }; }
+        iterator end() const noexcept { return {}; }
+
+        std::string str() const {
+            std::string s{};
+            s.reserve(total);
+            for (auto chunk : *this)
+                s += chunk;
+            return s;
+        }
+
+#if SAFMAT_OUT_FILE
+        bool write_to(FILE *file) const {
+            for (auto chunk : *this) {
+                if (std::fwrite(chunk.data(), 1, chunk.size(), file) != chunk.size())
+                    return false;
+            }
+            return true;
+        }
+#endif
+
+#if SAFMAT_POSIX
+        // Writes all blocks with as few writev() calls as possible.
+        bool write_to(int fd) const {
+# ifdef IOV_MAX
+            constexpr std::size_t max_iov = IOV_MAX;
+# else
+            constexpr std::size_t max_iov = 1024;
+# endif
+            std::vector<iovec> iov{};
+            const Block *b = head.get();
+            std::size_t off = 0;
+
+            while (true) {
+                while (b && off == b->size) {
+                    b = b->next.get();
+                    off = 0;
+                }
+                if (!b)
+                    return true;
+
+                iov.clear();
+                for (auto p = b; p && iov.size() < max_iov; p = p->next.get()) {
+                    const auto start = p == b ? off : 0;
+                    iov.push_back({ const_cast<char *>(p->data + start), p->size - start });
+                }
+
+                auto n = ::writev(fd, iov.data(), static_cast<int>(iov.size()));
+                if (n < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    return false;
+                }
+
+                // Skip the written bytes.
+                for (auto w = static_cast<std::size_t>(n); w != 0; ) {
+                    const auto m = std::min(w, b->size - off);
+                    off += m;
+                    w -= m;
+                    if (off == b->size) {
+                        b = b->next.get();
+                        off = 0;
+                    }
+                }
+            }
+        }
+#endif
+    };
+
+    template<>
+    struct OutputAdapter<ChunkedBuffer> {
+        inline static void write(ChunkedBuffer *out, std::string_view s) {
+            out->write(s);
+        }
+    };
+
 #if SAFMAT_OUT_OSTREAM
+    // Writes directly into the streambuf, which copies into its put area, if there is room.
+    // The sentry (flushing tie() before and unitbuf after writing) is constructed once per formatting call,
+    // or once per write, if the stream is written through an Output outside of such a call (eg. by a Tee).
+    // There is no is_tty(), because a streambuf doesn't expose its file descriptor, so std::ostream outputs
+    // (including std::cout) are never detected as terminals: use StyleMode::always to style them.
     template<>
     struct OutputAdapter<std::ostream> {
+        // The stream, whose sentry is held by the current thread's innermost Guard.
+        static std::ostream *&guarded() noexcept {
+            thread_local std::ostream *out{nullptr};
+            return out;
+        }
+
+        struct Guard {
+            std::ostream::sentry sentry;
+            std::ostream *prev;
+
+            Guard(std::ostream *out) : sentry{*out}, prev{std::exchange(guarded(), out)} {}
+            Guard(const Guard &) = delete;
+            Guard &operator=(const Guard &) = delete;
+            ~Guard() { guarded() = prev; }
+        };
+
+        inline static void put(std::ostream *out, std::string_view s) {
+            if (!out->good())
+                return;
+
+            const auto n = static_cast<std::streamsize>(s.size());
+            if (out->rdbuf()->sputn(s.data(), n) != n)
+                out->setstate(std::ios_base::badbit);
+        }
+
         inline static void write(std::ostream *out, std::string_view s) {
-            *out << s;
+            if (guarded() == out) {
+                put(out, s);
+            } else {
+                const Guard guard{out};
+                put(out, s);
+            }
         }
     };
 #endif // SAFMAT_OUT_OSTREAM
@@ -302,16 +863,47 @@ namespace safmat::io {
         inline static void write(FILE *out, std::string_view s) {
             std::fwrite(s.data(), 1, s.size(), out);
         }
+#if SAFMAT_POSIX
+        // isatty() of the first 64 file descriptors: 0 = unknown, 1 = terminal, -1 = not a terminal.
+        static inline std::atomic<signed char> tty_cache[64]{};
+
+        // isatty() is only called once for each of the first 64 file descriptors, see reset_tty_cache().
+        inline static bool is_tty(FILE *out) {
+            const int fd = ::fileno(out);
+            if (fd < 0 || fd >= 64)
+                return fd >= 0 && ::isatty(fd);
+
+            auto state = tty_cache[fd].load(std::memory_order_relaxed);
+            if (state == 0) {
+                state = ::isatty(fd) ? 1 : -1;
+                tty_cache[fd].store(state, std::memory_order_relaxed);
+            }
+            return state > 0;
+        }
+#endif
     };
+
+#if SAFMAT_POSIX
+    // Forgets the cached terminal check of fd (or of all file descriptors), which is needed after it was
+    // redirected (eg. by freopen() or dup2()) or closed and reused for another file.
+    inline void reset_tty_cache(int fd = -1) noexcept {
+        auto &cache = OutputAdapter<FILE>::tty_cache;
+        if (fd >= 0 && fd < 64) {
+            cache[fd].store(0, std::memory_order_relaxed);
+        } else if (fd < 0) {
+            for (auto &state : cache)
+                state.store(0, std::memory_order_relaxed);
+        }
+    }
+#endif
 #endif // SAFMAT_OUT_FILE
 }
 
 // Concepts used by Formatter<>'s.
 namespace safmat::concepts {
+    // Only implicit conversions count, C++23 added an explicit std::string_view constructor for ranges of char.
     template<class T>
-    concept StringLike = requires (T x) {
-        std::string_view{x};
-    };
+    concept StringLike = std::convertible_to<const T &, std::string_view>;
 
     template<class C>
     concept FormattableContainer = !StringLike<C> && requires (const C &c) {
@@ -321,10 +913,182 @@ namespace safmat::concepts {
 
     template<FormattableContainer C>
     using elem_type_t = std::remove_cvref_t<decltype(*begin(*(C *)0))>;
+
+    template<class C>
+    concept FormattableMap = FormattableContainer<C> && requires {
+        typename C::key_type;
+        typename C::mapped_type;
+    } && Formattable<typename C::key_type> && Formattable<typename C::mapped_type>;
+}
+
+// Enum name tables.
+namespace safmat {
+    // Range of values that is scanned for enumerator names.
+    // Specialize this for enums with values outside of the default range.
+    template<class E>
+    struct EnumRange {
+        using U = std::underlying_type_t<E>;
+        static constexpr long long min = std::is_signed_v<U> ? std::max<long long>(-128, std::numeric_limits<U>::min()) : 0;
+        static constexpr long long max = std::is_signed_v<U> ? std::min<long long>(127, std::numeric_limits<U>::max()) : std::min<long long>(255, std::numeric_limits<U>::max());
+    };
+
+    // Specialize this to register the names of an enum manually, eg.:
+    //   static constexpr std::array<std::pair<E, std::string_view>, N> names{ ... };
+    template<class E>
+    struct EnumNames;
+}
+
+namespace safmat::internal {
+    template<auto V>
+    constexpr std::string_view enum_value_name() noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+        // GCC:   "... [with auto V = Color::Red; ...]"
+        // Clang: "... [V = Color::Red]"
+        constexpr std::string_view sig = __PRETTY_FUNCTION__;
+        constexpr auto start = sig.find("V = ") + 4;
+        constexpr auto name = sig.substr(start, sig.find_first_of(";]", start) - start);
+
+        // Values without an enumerator are printed as a cast, eg. "(Color)5".
+        if constexpr (name.empty() || name[0] == '(' || name[0] == '-' || (name[0] >= '0' && name[0] <= '9')) {
+            return {};
+        } else {
+            return name.substr(name.rfind(':') + 1);
+        }
+#else
+        return {};
+#endif
+    }
+
+    template<class E>
+    concept RegisteredEnum = requires {
+        { EnumNames<E>::names[0].first } -> std::convertible_to<E>;
+        { EnumNames<E>::names[0].second } -> std::convertible_to<std::string_view>;
+    };
+
+    template<class E>
+    struct EnumTable {
+        static constexpr long long min = EnumRange<E>::min;
+        static constexpr long long max = EnumRange<E>::max;
+
+        static constexpr auto names = []<std::size_t... I>(std::index_sequence<I...>) {
+            return std::array<std::string_view, sizeof...(I)>{ enum_value_name<static_cast<E>(min + static_cast<long long>(I))>()... };
+        }(std::make_index_sequence<max - min + 1>{});
+
+        static constexpr std::string_view lookup(E e) noexcept {
+            const auto v = static_cast<long long>(e);
+            return v >= min && v <= max ? names[v - min] : std::string_view{};
+        }
+    };
+
+    template<RegisteredEnum E>
+    struct EnumTable<E> {
+        static constexpr auto &entries = EnumNames<E>::names;
+        static constexpr long long min = static_cast<long long>(std::ranges::min(entries, {}, [](const auto &p) { return static_cast<long long>(p.first); }).first);
+        static constexpr long long max = static_cast<long long>(std::ranges::max(entries, {}, [](const auto &p) { return static_cast<long long>(p.first); }).first);
+
+        // Sparse tables (eg. flags) are searched linearly instead.
+        static constexpr bool dense = max - min < 1024;
+
+        static constexpr auto names = [] {
+            std::array<std::string_view, dense ? max - min + 1 : 0> names{};
+            if constexpr (dense) {
+                for (const auto &[e, name] : entries)
+                    names[static_cast<long long>(e) - min] = name;
+            }
+            return names;
+        }();
+
+        static constexpr std::string_view lookup(E e) noexcept {
+            const auto v = static_cast<long long>(e);
+            if constexpr (dense) {
+                return v >= min && v <= max ? names[v - min] : std::string_view{};
+            } else {
+                for (const auto &[x, name] : entries) {
+                    if (x == e)
+                        return name;
+                }
+                return {};
+            }
+        }
+    };
+}
+
+// Matrix views.
+namespace safmat {
+    template<class T>
+    class Matrix {
+    private:
+        const T *data;
+        std::unique_ptr<const T *[]> row_ptrs{};
+    public:
+        std::size_t rows, cols;
+
+        Matrix(const T *data, std::size_t rows, std::size_t cols) : data{data}, rows{rows}, cols{cols} {}
+        Matrix(std::unique_ptr<const T *[]> row_ptrs, std::size_t rows, std::size_t cols)
+            : data{nullptr}, row_ptrs{std::move(row_ptrs)}, rows{rows}, cols{cols} {}
+
+        std::span<const T> row(std::size_t i) const {
+            return { row_ptrs ? row_ptrs[i] : data + i * cols, cols };
+        }
+    };
+
+    // Row-major matrix of contiguous data.
+    template<class T>
+    Matrix<T> matrix(const T *data, std::size_t rows, std::size_t cols) {
+        return { data, rows, cols };
+    }
+
+    template<class R> requires requires (const R &r) { std::data(r); std::size(r); }
+    auto matrix(const R &r, std::size_t rows, std::size_t cols) {
+        if (std::size(r) != rows * cols)
+            throw format_error{"Matrix size does not match the data."};
+        return matrix(std::data(r), rows, cols);
+    }
+
+    // Matrix of contiguous rows, eg. std::vector<std::vector<T>>.
+    template<class R> requires requires (const R &r) { std::data(*begin(r)); std::size(*begin(r)); }
+    auto matrix(const R &r) {
+        using T = std::remove_cvref_t<decltype(*std::data(*begin(r)))>;
+
+        const std::size_t rows = std::size(r);
+        const std::size_t cols = rows != 0 ? std::size(*begin(r)) : 0;
+        auto ptrs = std::make_unique<const T *[]>(rows);
+
+        std::size_t i{0};
+        for (const auto &row : r) {
+            if (std::size(row) != cols)
+                throw format_error{"Rows of a matrix must have the same length."};
+            ptrs[i++] = std::data(row);
+        }
+
+        return Matrix<T>{ std::move(ptrs), rows, cols };
+    }
+
+#if __cpp_lib_mdspan >= 202207L
+    template<class T, class Extents, class Layout, class Accessor> requires (Extents::rank() == 2)
+    auto matrix(std::mdspan<T, Extents, Layout, Accessor> m) {
+        using U = std::remove_const_t<T>;
+
+        if (m.extent(1) > 1 && m.stride(1) != 1)
+            throw format_error{"Rows of a matrix must be contiguous."};
+
+        auto ptrs = std::make_unique<const U *[]>(m.extent(0));
+        for (std::size_t i = 0; i < m.extent(0); ++i)
+            ptrs[i] = m.data_handle() + i * m.stride(0);
+
+        return Matrix<U>{ std::move(ptrs), m.extent(0), m.extent(1) };
+    }
+#endif
 }
 
 // Formatter<> helpers.
 namespace safmat::internal {
+#ifdef __SIZEOF_INT128__
+    // __extension__ keeps -Wpedantic quiet about the non-standard type.
+    __extension__ typedef __int128 int128;
+    __extension__ typedef unsigned __int128 uint128;
+#endif
+
     class NestedSizeArgFormatter {
     private:
         // std::monostate   => unspecified,
@@ -400,7 +1164,7 @@ namespace safmat::internal {
             parse_width(in);
         }
 
-        void print_padding(Output out, std::size_t len, std::size_t add) {
+        void print_padding(const Output &out, std::size_t len, std::size_t add) {
             const std::string pad(fill == '^' ? (len + add) / 2 : len, padding);
             out.write(pad);
         }
@@ -408,20 +1172,172 @@ namespace safmat::internal {
         void read_width(FormatContext &ctx) { NestedSizeArgFormatter::read(ctx); }
         std::size_t width() const { return NestedSizeArgFormatter::arg.value_or(0); }
 
-        void pre_format(Output out, std::size_t len) {
+        void pre_format(const Output &out, std::size_t len) {
             if (len < width() && (fill == '>' || fill == '^')) {
                 print_padding(out, width() - len, 0);
             }
         }
-        void post_format(Output out, std::size_t len) {
+        void post_format(const Output &out, std::size_t len) {
             if (len < width() && (fill == '<' || fill == '^')) {
                 print_padding(out, width() - len, 1);
             }
         }
     };
 
-    struct PrecisionFormatter : private NestedSizeArgFormatter {
-        void read_prec(FormatContext &ctx) { NestedSizeArgFormatter::read(ctx); }
+    // Pads text, that is written instead of a value (eg. "none" for an empty std::optional),
+    // with the fill and width of the value's spec. The spec is only peeked at, the value's formatter parses it.
+    struct PlaceholderFormatter : PaddedFormatter {
+        void parse(InputIterator in) {
+            parse_fill(in);
+            while (*in == '+' || *in == '-' || *in == ' ' || *in == '#' || *in == '0')
+                ++in;
+            parse_width(in);
+        }
+
+        void format_to(FormatContext &ctx, std::string_view s) {
+            PaddedFormatter::read_width(ctx);
+            PaddedFormatter::pre_format(ctx.out, s.size());
+            ctx.out.write(s);
+            PaddedFormatter::post_format(ctx.out, s.size());
+        }
+    };
+
+    // Stores the format spec, so it can be parsed later by a formatter,
+    // which is only known at format-time (eg. the alternative of a std::variant).
+    class DeferredSpec {
+    private:
+        std::optional<InputIterator> spec{};
+    public:
+        void parse(InputIterator &in) {
+            spec = in;
+
+            std::size_t depth{0};
+            while (*in != '}' || depth != 0) {
+                if (*in == '\0')
+                    throw format_error{"Expected '}'."};
+                else if (*in == '{')
+                    ++depth;
+                else if (*in == '}')
+                    --depth;
+                ++in;
+            }
+        }
+
+        template<class F>
+        void apply(F &fmt) const {
+            if (!spec.has_value())
+                return;
+
+            auto in = spec.value();
+            fmt.parse(in);
+
+            if (*in != '}')
+                throw format_error{"Expected '}'."};
+        }
+    };
+
+    // Parses a nested "{:spec}" group (eg. the key spec of a map) into fmt. Returns false, if there is no group.
+    // A bare "{}" is a nested argument (eg. the width in "{}.{}f"), unless only a group may follow (empty_group),
+    // where it leaves fmt unchanged.
+    template<class F>
+    bool parse_group(InputIterator &in, F &fmt, bool empty_group = false) {
+        if (*in != '{' || !(in[1] == ':' || (empty_group && in[1] == '}')))
+            return false;
+
+        ++in;
+        if (*in == ':') {
+            ++in;
+            fmt.parse(in);
+        }
+
+        if (*in != '}')
+            throw format_error{"Expected '}' after nested spec."};
+
+        ++in;
+        return true;
+    }
+
+#if SAFMAT_THREADS
+    // Runs f(0), ..., f(n - 1) in parallel and rethrows the first exception.
+    template<class F>
+    void parallel_for(std::size_t n, F f) {
+        std::vector<std::exception_ptr> errors(n);
+        std::vector<std::thread> threads{};
+
+        const auto run = [&](std::size_t i) {
+            try {
+                f(i);
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        };
+
+        threads.reserve(n);
+        for (std::size_t i = 1; i < n; ++i)
+            threads.emplace_back(run, i);
+        run(0);
+
+        for (auto &t : threads)
+            t.join();
+        for (auto &e : errors) {
+            if (e)
+                std::rethrow_exception(e);
+        }
+    }
+#endif
+
+    template<class T>
+    struct MatrixPrinter {
+        Formatter<T> elem;
+        std::span<FormatArg> args;
+
+        // Updates widths with the lengths of the cells in rows [first, last).
+        void measure(const Matrix<T> &m, std::size_t first, std::size_t last, std::vector<std::size_t> &widths) {
+            io::Counter counter{};
+            const Output counted{counter};
+            FormatContext ctx{ counted, args };
+
+            for (std::size_t i = first; i < last; ++i) {
+                const auto row = m.row(i);
+                for (std::size_t j = 0; j < m.cols; ++j) {
+                    counter.count = 0;
+                    elem.format_to(ctx, row[j]);
+                    widths[j] = std::max(widths[j], counter.count);
+                }
+            }
+        }
+
+        // Writes rows [first, last) with right-aligned columns.
+        void render(const Matrix<T> &m, std::size_t first, std::size_t last, const std::vector<std::size_t> &widths, const Output &out) {
+            std::string buf{};
+            std::vector<std::size_t> ends(m.cols);
+            const std::string pad(std::ranges::max(widths), ' ');
+            const Output bout{buf};
+            FormatContext ctx{ bout, args };
+
+            for (std::size_t i = first; i < last; ++i) {
+                const auto row = m.row(i);
+
+                buf.clear();
+                for (std::size_t j = 0; j < m.cols; ++j) {
+                    elem.format_to(ctx, row[j]);
+                    ends[j] = buf.size();
+                }
+
+                out.write(i == 0 ? "[[" : " [");
+                for (std::size_t j = 0, start = 0; j < m.cols; start = ends[j++]) {
+                    if (j != 0)
+                        out.write(", ");
+                    out.write(std::string_view{pad}.substr(0, widths[j] - (ends[j] - start)));
+                    out.write(std::string_view{buf}.substr(start, ends[j] - start));
+                }
+                out.write(i + 1 == m.rows ? "]]" : "],\n");
+            }
+        }
+    };
+
+    struct PrecisionFormatter : private NestedSizeArgFormatter {
+        void read_prec(FormatContext &ctx) { NestedSizeArgFormatter::read(ctx); }
         auto prec() const { return NestedSizeArgFormatter::arg; }
         void set_prec(std::size_t n) { arg = n; }
 
@@ -491,8 +1407,206 @@ namespace safmat::internal {
 
     };
 
+#if SAFMAT_SMALL_INTS
+    // "0000" to "9999", so small numbers are copied with a single load and store.
+    inline constexpr auto small_ints = [] {
+        std::array<char, 4 * 10000> table{};
+        for (std::size_t i = 0; i < 10000; ++i) {
+            table[4 * i + 0] = static_cast<char>('0' + i / 1000);
+            table[4 * i + 1] = static_cast<char>('0' + i / 100 % 10);
+            table[4 * i + 2] = static_cast<char>('0' + i / 10 % 10);
+            table[4 * i + 3] = static_cast<char>('0' + i % 10);
+        }
+        return table;
+    }();
+#endif
+
+    // Writes x in decimal to [first, last), which must have room for at least 4 characters.
+    template<std::unsigned_integral U>
+    char *to_decimal(char *first, char *last, U x) noexcept {
+#if SAFMAT_SMALL_INTS
+        if (x < 10000) {
+            // Copies all 4 bytes, but only the last n digits count.
+            const std::size_t n = 1 + (x >= 10) + (x >= 100) + (x >= 1000);
+            std::memcpy(first, small_ints.data() + 4 * x + (4 - n), 4);
+            return first + n;
+        }
+#endif
+        return std::to_chars(first, last, x).ptr;
+    }
+
+    template<std::unsigned_integral U>
+    char *to_chars_base(char *first, char *last, U x, int base) noexcept {
+        return base == 10 ? to_decimal(first, last, x) : std::to_chars(first, last, x, base).ptr;
+    }
+
+#ifdef __SIZEOF_INT128__
+    // (hi * 2^64 + lo) / d and its remainder for hi < d, with 64-bit operations only
+    // (Hacker's Delight, divlu), because the compiler turns 128-bit divisions into calls to __udivti3().
+    constexpr std::uint64_t div128by64(std::uint64_t hi, std::uint64_t lo, std::uint64_t d, std::uint64_t &rem) noexcept {
+        constexpr std::uint64_t b = std::uint64_t{1} << 32;
+
+        // Normalize, so that the divisor's highest bit is set.
+        const int s = std::countl_zero(d);
+        d <<= s;
+        hi = (hi << s) | (s == 0 ? 0 : lo >> (64 - s));
+        lo <<= s;
+
+        const auto d1 = d >> 32, d0 = d & (b - 1);
+        const auto l1 = lo >> 32, l0 = lo & (b - 1);
+
+        auto q1 = hi / d1, r = hi % d1;
+        while (q1 >= b || q1 * d0 > ((r << 32) | l1)) {
+            --q1;
+            r += d1;
+            if (r >= b)
+                break;
+        }
+
+        const auto u = (hi << 32 | l1) - q1 * d;
+        auto q0 = u / d1;
+        r = u % d1;
+        while (q0 >= b || q0 * d0 > ((r << 32) | l0)) {
+            --q0;
+            r += d1;
+            if (r >= b)
+                break;
+        }
+
+        rem = ((u << 32 | l0) - q0 * d) >> s;
+        return q1 << 32 | q0;
+    }
+
+    // x / d and x % d, split into the 64-bit halves of x.
+    constexpr uint128 divmod(uint128 x, std::uint64_t d, std::uint64_t &rem) noexcept {
+        const auto hi = static_cast<std::uint64_t>(x >> 64);
+        const auto lo = div128by64(hi % d, static_cast<std::uint64_t>(x), d, rem);
+        return static_cast<uint128>(hi / d) << 64 | lo;
+    }
+
+    // Formats x in chunks of k digits, where Base^k is the largest power of Base, that fits in 64 bits (eg. 10^19).
+    template<unsigned Base>
+    char *to_chars_u128(char *first, char *last, uint128 x) noexcept {
+        constexpr auto chunk = [] {
+            std::uint64_t d = Base;
+            int k = 1;
+            while (d <= std::numeric_limits<std::uint64_t>::max() / Base) {
+                d *= Base;
+                ++k;
+            }
+            return std::pair{ d, k };
+        }();
+
+        if (x <= std::numeric_limits<std::uint64_t>::max())
+            return to_chars_base(first, last, static_cast<std::uint64_t>(x), Base);
+
+        std::uint64_t rem;
+        first = to_chars_u128<Base>(first, last, divmod(x, chunk.first, rem));
+
+        // The lower chunk with leading zeros.
+        char tmp[64];
+        const auto n = to_chars_base(tmp, std::end(tmp), rem, Base) - tmp;
+        std::memset(first, '0', chunk.second - n);
+        std::memcpy(first + (chunk.second - n), tmp, n);
+        return first + chunk.second;
+    }
+
+    inline char *to_chars_base(char *first, char *last, uint128 x, int base) noexcept {
+        switch (base) {
+        case 2:
+            return to_chars_u128<2>(first, last, x);
+        case 8:
+            return to_chars_u128<8>(first, last, x);
+        case 16:
+            return to_chars_u128<16>(first, last, x);
+        default:
+            return to_chars_u128<10>(first, last, x);
+        }
+    }
+#endif
+
+    template<class U>
+    concept UnsignedInteger = std::unsigned_integral<U>
+#ifdef __SIZEOF_INT128__
+        || std::same_as<U, uint128>
+#endif
+        ;
+
+    // Digits of the radix presentation ({:rN}); base 62 uses 0-9a-zA-Z.
+    inline constexpr std::string_view radix_digits{"0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"};
+    inline constexpr std::string_view radix_digits_upper{"0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ"};
+
+    struct Radix {
+        std::uint32_t base;
+        std::uint32_t chunk;        // largest power of base, that fits in 32 bits
+        unsigned digits;            // number of digits in a chunk
+        std::uint64_t magic;        // ceil(2^64 / base), see fastdiv()
+    };
+
+    inline constexpr auto radixes = [] {
+        std::array<Radix, 63> table{};
+        for (std::uint32_t b = 2; b < table.size(); ++b) {
+            std::uint64_t chunk = b;
+            unsigned digits = 1;
+            while (chunk * b <= std::numeric_limits<std::uint32_t>::max()) {
+                chunk *= b;
+                ++digits;
+            }
+            table[b] = { b, static_cast<std::uint32_t>(chunk), digits, std::numeric_limits<std::uint64_t>::max() / b + 1 };
+        }
+        return table;
+    }();
+
+    // n / r.base with a multiplication and a shift (Lemire et al., "Faster Remainder by Direct Computation"),
+    // exact for all 32-bit n.
+    constexpr std::uint32_t fastdiv(std::uint32_t n, const Radix &r) noexcept {
+#ifdef __SIZEOF_INT128__
+        return static_cast<std::uint32_t>((static_cast<uint128>(r.magic) * n) >> 64);
+#else
+        return n / r.base;
+#endif
+    }
+
+    // Writes x in base 2 to 36 or 62 to first, which must have room for sizeof (U) * 8 characters.
+    // Wider values are split into 32-bit chunks of whole digits, so that only one wide division is done per chunk.
+    template<UnsignedInteger U>
+    char *to_chars_radix(char *first, U x, unsigned base, std::string_view digits) noexcept {
+        const auto &r = radixes[base];
+        char buffer[sizeof (U) * 8];
+        char *p = std::end(buffer);
+
+        while (x > std::numeric_limits<std::uint32_t>::max()) {
+            std::uint32_t c;
+            if constexpr (sizeof (U) > 8) {
+                std::uint64_t rem;
+                x = divmod(x, r.chunk, rem);
+                c = static_cast<std::uint32_t>(rem);
+            } else {
+                c = static_cast<std::uint32_t>(x % r.chunk);
+                x /= r.chunk;
+            }
+            for (unsigned i = 0; i < r.digits; ++i) {
+                const auto q = fastdiv(c, r);
+                *--p = digits[c - q * r.base];
+                c = q;
+            }
+        }
+
+        auto c = static_cast<std::uint32_t>(x);
+        do {
+            const auto q = fastdiv(c, r);
+            *--p = digits[c - q * r.base];
+            c = q;
+        } while (c != 0);
+
+        const auto n = std::end(buffer) - p;
+        std::memcpy(first, p, n);
+        return first + n;
+    }
+
     struct IntegralFormatter : NumericFormatter {
         char rep;
+        unsigned radix{10};
 
         IntegralFormatter(char rep) : rep{rep} {}
 
@@ -514,6 +1628,15 @@ namespace safmat::internal {
             case 'X':
                 rep = *in++;
                 break;
+            case 'r':
+            case 'R':
+                rep = *in++;
+                radix = 0;
+                while (std::isdigit(*in) && radix < 100)
+                    radix = radix * 10 + (*in++ - '0');
+                if (radix < 2 || (radix > 36 && (radix != 62 || rep == 'R')))
+                    throw format_error{"Invalid radix."};
+                break;
             case '}':
                 break;
             case 's':
@@ -526,10 +1649,11 @@ namespace safmat::internal {
                 throw format_error("Expected '}'.");
             }
         }
-        void format(FormatContext &ctx, std::function<std::string(int)> f, bool negative) {
-            std::string number{};
-
-            PaddedFormatter::read_width(ctx);
+        // Formats an integer, given its magnitude x.
+        template<UnsignedInteger U>
+        void format(FormatContext &ctx, U x, bool negative) {
+            char buffer[sizeof (U) * 8 + 2];
+            char *p = buffer;
 
             switch (rep) {
             case 'b':
@@ -537,29 +1661,39 @@ namespace safmat::internal {
             case 'x':
             case 'X':
                 if (alternate) {
-                    number += '0';
-                    number += rep;
+                    *p++ = '0';
+                    *p++ = rep;
                 }
-                number += f(std::tolower(rep) == 'b' ? 2 : 16);
+                p = to_chars_base(p, std::end(buffer), x, std::tolower(rep) == 'b' ? 2 : 16);
+                if (rep == 'X')
+                    std::for_each(buffer, p, [](char &ch) { ch = std::toupper(static_cast<unsigned char>(ch)); });
                 break;
             case 'c':
+                // The character itself, not its magnitude.
+                *p++ = static_cast<char>(negative ? static_cast<U>(U{} - x) : x);
+                negative = false;
+                break;
             case 'd':
             case '\0':
-                number = f(rep == 'c' ? 0 : 10);
+                p = to_chars_base(p, std::end(buffer), x, 10);
                 break;
             case 'o':
-                if (alternate)
-                    number += '0';
-                number += f(8);
+                if (alternate && x != 0)
+                    *p++ = '0';
+                p = to_chars_base(p, std::end(buffer), x, 8);
                 break;
-            case 's':
-                number = f(1);
+            case 'r':
+            case 'R':
+                p = to_chars_radix(p, x, radix, rep == 'R' ? radix_digits_upper : radix_digits);
                 break;
+            case 's':
+                NumericFormatter::format(ctx, x ? "true" : "false", negative);
+                return;
             default:
                 throw format_error{"Unimplemented operation."};
             }
 
-            NumericFormatter::format(ctx, number, negative);
+            NumericFormatter::format(ctx, { buffer, p }, negative);
         }
     };
 
@@ -670,36 +1804,41 @@ namespace safmat {
        }
 
         void format_to(FormatContext &ctx, T x) {
-            bool is_negative;
+            using U = std::make_unsigned_t<T>;
 
             if constexpr (std::is_signed_v<T>) {
-                is_negative = x < T{};
-                if (is_negative)
-                    x = -x;
+                const bool negative = x < T{};
+                IntegralFormatter::format(ctx, negative ? static_cast<U>(U{} - static_cast<U>(x)) : static_cast<U>(x), negative);
             } else {
-                is_negative = false;
+                IntegralFormatter::format(ctx, x, false);
             }
+        }
+    };
 
-            const auto f = [x](int base) -> std::string {
-                if (base == 0) {
-                    return std::string(1, static_cast<char>(x));
-                } else if (base == 1) {
-                    return x ? "true" : "false";
-                }
+#ifdef __SIZEOF_INT128__
+    // std::integral<__int128> is false in strict ISO mode (-std=c++20), so they need their own specializations.
+    template<>
+    struct Formatter<internal::uint128> : internal::IntegralFormatter {
+        Formatter() : IntegralFormatter{'d'} {}
 
-                char buffer[sizeof (T) * 8 + 2];
-                const auto result = std::to_chars(buffer, buffer + sizeof buffer, x, base);
-                if (result.ec == std::errc{}) {
-                    *result.ptr = '\0';
-                    return buffer;
-                } else {
-                    throw format_error{"Number too big."};
-                }
-            };
+        void parse(InputIterator &in) {
+            IntegralFormatter::parse(in, false);
+        }
+
+        void format_to(FormatContext &ctx, internal::uint128 x) {
+            IntegralFormatter::format(ctx, x, false);
+        }
+    };
 
-            IntegralFormatter::format(ctx, f, is_negative);
+    template<>
+    struct Formatter<internal::int128> : Formatter<internal::uint128> {
+        void format_to(FormatContext &ctx, internal::int128 x) {
+            const bool negative = x < 0;
+            const auto u = static_cast<internal::uint128>(x);
+            IntegralFormatter::format(ctx, negative ? -u : u, negative);
         }
     };
+#endif
 
     template<>
     struct Formatter<bool> : Formatter<unsigned> {
@@ -746,6 +1885,73 @@ namespace safmat {
     template<concepts::StringLike T>
     struct Formatter<T> : internal::StringFormatter {};
 
+    template<class E> requires std::is_enum_v<E>
+    struct Formatter<E> : internal::PaddedFormatter {
+        using U = std::underlying_type_t<E>;
+        char rep{'s'};
+
+        void parse(InputIterator &in) {
+            PaddedFormatter::parse(in);
+
+            // Parse rep.
+            switch (*in) {
+            case 's':
+            case 'b':
+            case 'B':
+            case 'd':
+            case 'o':
+            case 'x':
+            case 'X':
+                rep = *in++;
+                break;
+            case '}':
+                break;
+            default:
+                throw format_error("Expected '}'.");
+            }
+        }
+
+        void format_to(FormatContext &ctx, E e) {
+            PaddedFormatter::read_width(ctx);
+
+            auto s = rep == 's' ? internal::EnumTable<E>::lookup(e) : std::string_view{};
+            char buffer[sizeof (U) * 8 + 1];
+
+            // Fall back to the integer value.
+            if (s.empty()) {
+                int base;
+                switch (rep) {
+                case 'b':
+                case 'B':
+                    base = 2;
+                    break;
+                case 'o':
+                    base = 8;
+                    break;
+                case 'x':
+                case 'X':
+                    base = 16;
+                    break;
+                default:
+                    base = 10;
+                    break;
+                }
+
+                // Cast through a non-char type, to make sure to_chars() prints a number.
+                using I = std::conditional_t<std::is_signed_v<U>, long long, unsigned long long>;
+                const auto r = std::to_chars(buffer, buffer + sizeof buffer, static_cast<I>(e), base);
+                if (rep == 'X')
+                    std::for_each(buffer, r.ptr, [](char &ch){ ch = std::toupper(static_cast<unsigned char>(ch)); });
+                s = { buffer, r.ptr };
+            }
+
+            auto &out = ctx.out;
+            PaddedFormatter::pre_format(out, s.length());
+            out.write(s);
+            PaddedFormatter::post_format(out, s.length());
+        }
+    };
+
     template<Formattable A, Formattable B>
     struct Formatter<std::pair<A, B>> : internal::PaddedFormatter {
         using T = std::pair<A, B>;
@@ -754,6 +1960,19 @@ namespace safmat {
             const auto &[a, b] = p;
             internal::PaddedFormatter::read_width(ctx);
 
+            // Only build a temporary string, if padding requires the length.
+            if (width() == 0) {
+                Formatter<A> fa{};
+                Formatter<B> fb{};
+
+                ctx.out.write('(');
+                fa.format_to(ctx, a);
+                ctx.out.write(", ");
+                fb.format_to(ctx, b);
+                ctx.out.write(')');
+                return;
+            }
+
             const auto f = format("({}, {})", a, b);
 
             internal::PaddedFormatter::pre_format(ctx.out, f.length());
@@ -762,37 +1981,2337 @@ namespace safmat {
         }
     };
 
+    // Format: {:[n][:elem-spec]} or {:elem-spec}
+    // 'n' omits the brackets, elem-spec may also be given as a "{:elem-spec}" group.
+    // A spec starting with ':' and an alignment (eg. "{::>4}") is an elem-spec with the fill ':'.
+    // The element formatter is parsed once and reused for all elements.
     template<concepts::FormattableContainer C>
-    struct Formatter<C> : Formatter<concepts::elem_type_t<C>> {
+    struct Formatter<C> {
         using T = concepts::elem_type_t<C>;
-        using F = Formatter<T>;
 
-        void format_to(FormatContext &ctx, const C &c) {
+        Formatter<T> elem{};
+        bool brackets{true};
+
+        void parse(InputIterator &in) {
+            // A leading ':' followed by an alignment is the fill of the elements (eg. "{::>4}").
+            if (*in == ':' && (in[1] == '<' || in[1] == '>' || in[1] == '^')) {
+                elem.parse(in);
+                return;
+            }
+
+            if (*in == 'n' && (in[1] == ':' || in[1] == '}')) {
+                brackets = false;
+                ++in;
+            }
+
+            if (*in == ':') {
+                ++in;
+                if (!internal::parse_group(in, elem))
+                    elem.parse(in);
+            } else if (brackets) {
+                elem.parse(in);
+            }
+        }
+
+        // Progress of format_step(), which formats one element at a time (eg. for ResumableFormat).
+        struct Cursor {
+            std::optional<decltype(begin(std::declval<const C &>()))> it{};
+            bool first{true};
+        };
+
+        bool format_step(FormatContext &ctx, const C &c, Cursor &cur) {
             auto &out = ctx.out;
-            auto it = begin(c);
-            const auto e = end(c);
+            if (!cur.it.has_value()) {
+                if (brackets)
+                    out.write('[');
+                cur.it = begin(c);
+            }
 
-            out.write('[');
-            if (it != e) {
-                F::format_to(ctx, *it++);
-                while (it != e) {
+            auto &it = *cur.it;
+            if (it != end(c)) {
+                if (!std::exchange(cur.first, false))
                     out.write(", ");
-                    F::format_to(ctx, *it++);
-                }
+                elem.format_to(ctx, *it++);
+                if (it != end(c))
+                    return false;
             }
-            out.write(']');
+
+            if (brackets)
+                out.write(']');
+            return true;
+        }
+
+        void format_to(FormatContext &ctx, const C &c) {
+            Cursor cur{};
+            while (!format_step(ctx, c, cur));
         }
     };
 
-#if __cpp_lib_source_location >= 201907L
     template<>
-    struct Formatter<std::source_location> : internal::PaddedFormatter {
-	void format_to(FormatContext &ctx, const std::source_location &loc) {
-	    auto &out = ctx.out;
-	    safmat::format_to(out, "{}:{}:{}", loc.file_name(), loc.line(), loc.column());
-	}
+    struct Formatter<std::monostate> : internal::StringFormatter {
+        void format_to(FormatContext &ctx, std::monostate) {
+            StringFormatter::format_to(ctx, "monostate");
+        }
+    };
+
+    template<Formattable T>
+    struct Formatter<std::optional<T>> : Formatter<T> {
+        internal::PlaceholderFormatter none{};
+
+        void parse(InputIterator &in) {
+            none.parse(in);
+            Formatter<T>::parse(in);
+        }
+
+        void format_to(FormatContext &ctx, const std::optional<T> &x) {
+            if (x.has_value()) {
+                Formatter<T>::format_to(ctx, x.value());
+            } else {
+                none.format_to(ctx, "none");
+            }
+        }
+    };
+
+    template<Formattable... Ts>
+    struct Formatter<std::variant<Ts...>> {
+        internal::DeferredSpec spec{};
+        internal::PlaceholderFormatter valueless{};
+
+        void parse(InputIterator &in) {
+            valueless.parse(in);
+            spec.parse(in);
+        }
+
+        void format_to(FormatContext &ctx, const std::variant<Ts...> &v) {
+            if (v.valueless_by_exception()) {
+                valueless.format_to(ctx, "valueless");
+                return;
+            }
+
+            // Only the formatter of the held alternative parses the spec.
+            std::visit([this, &ctx]<class T>(const T &x) {
+                Formatter<T> fmt{};
+                spec.apply(fmt);
+                fmt.format_to(ctx, x);
+            }, v);
+        }
+    };
+
+#if __cpp_lib_expected >= 202202L
+    template<Formattable T, Formattable E>
+    struct Formatter<std::expected<T, E>> : Formatter<T> {
+        internal::PlaceholderFormatter unexpected{};
+
+        void parse(InputIterator &in) {
+            unexpected.parse(in);
+            Formatter<T>::parse(in);
+        }
+
+        void format_to(FormatContext &ctx, const std::expected<T, E> &x) {
+            if (x.has_value()) {
+                Formatter<T>::format_to(ctx, x.value());
+            } else {
+                // The error is formatted first, so the whole "unexpected(...)" can be padded.
+                std::string err{"unexpected("};
+                const Output eout{err};
+                FormatContext ectx{ eout, ctx.args };
+                Formatter<E> fmt{};
+                fmt.format_to(ectx, x.error());
+                err += ')';
+                unexpected.format_to(ctx, err);
+            }
+        }
     };
 #endif
+
+    // Format: {:[n][:{:key-spec}{:value-spec}]}
+    // 'n' omits the braces.
+    template<concepts::FormattableMap C>
+    struct Formatter<C> {
+        using K = typename C::key_type;
+        using V = typename C::mapped_type;
+
+        Formatter<K> key{};
+        Formatter<V> value{};
+        bool braces{true};
+
+        void parse(InputIterator &in) {
+            if (*in == 'n') {
+                braces = false;
+                ++in;
+            }
+
+            if (*in == ':') {
+                ++in;
+                if (!internal::parse_group(in, key, true))
+                    throw format_error{"Expected key spec."};
+                internal::parse_group(in, value, true);
+            }
+        }
+
+        // Progress of format_step(), which formats one entry at a time (eg. for ResumableFormat).
+        struct Cursor {
+            std::optional<decltype(begin(std::declval<const C &>()))> it{};
+            bool first{true};
+        };
+
+        bool format_step(FormatContext &ctx, const C &c, Cursor &cur) {
+            auto &out = ctx.out;
+            if (!cur.it.has_value()) {
+                if (braces)
+                    out.write('{');
+                cur.it = begin(c);
+            }
+
+            auto &it = *cur.it;
+            if (it != end(c)) {
+                if (!std::exchange(cur.first, false))
+                    out.write(", ");
+                const auto &[k, v] = *it++;
+                key.format_to(ctx, k);
+                out.write(": ");
+                value.format_to(ctx, v);
+                if (it != end(c))
+                    return false;
+            }
+
+            if (braces)
+                out.write('}');
+            return true;
+        }
+
+        void format_to(FormatContext &ctx, const C &c) {
+            Cursor cur{};
+            while (!format_step(ctx, c, cur));
+        }
+    };
+
+    // Format: {:[p[threads]][:elem-spec]}
+    // Columns are right-aligned to their widest cell.
+    // 'p' measures and formats blocks of rows in parallel threads, for very large matrices.
+    // By default, there is one thread per core, but at most one per block_rows rows.
+    template<Formattable T>
+    struct Formatter<Matrix<T>> {
+        static constexpr std::size_t block_rows = 256;
+
+        Formatter<T> elem{};
+        bool parallel{false};
+        std::size_t threads{0};
+
+        void parse(InputIterator &in) {
+            if (*in == 'p') {
+                parallel = true;
+                ++in;
+                while (*in >= '0' && *in <= '9')
+                    threads = threads * 10 + (*in++ - '0');
+            }
+
+            if (*in == ':') {
+                ++in;
+                if (!internal::parse_group(in, elem))
+                    elem.parse(in);
+            }
+        }
+
+        void format_to(FormatContext &ctx, const Matrix<T> &m) {
+            if (m.rows == 0 || m.cols == 0) {
+                ctx.out.write("[]");
+                return;
+            }
+
+            // Format the first cell once, to read nested arguments (eg. "{:{}}") in order.
+            // Afterwards elem doesn't touch the FormatContext's state anymore and can be copied into other threads.
+            {
+                io::Counter counter{};
+                const Output counted{counter};
+                FormatContext first{ counted, ctx.args, ctx.carg };
+                elem.format_to(first, m.row(0)[0]);
+                ctx.carg = first.carg;
+            }
+
+            std::vector<std::size_t> widths(m.cols);
+
+#if SAFMAT_THREADS
+            const std::size_t nthreads = threads != 0
+                ? std::min(threads, (m.rows + block_rows - 1) / block_rows)
+                : std::min<std::size_t>(std::thread::hardware_concurrency(), m.rows / block_rows);
+            if (parallel && nthreads > 1) {
+                format_parallel(ctx, m, nthreads);
+                return;
+            }
+#endif
+
+            internal::MatrixPrinter<T> p{ elem, ctx.args };
+            p.measure(m, 0, m.rows, widths);
+            p.render(m, 0, m.rows, widths, ctx.out);
+        }
+
+#if SAFMAT_THREADS
+        // The workers are started once: each one measures a stripe of rows and then renders every nthreads-th block.
+        // The calling thread writes the finished blocks in order, at most 2 * nthreads blocks are buffered.
+        void format_parallel(FormatContext &ctx, const Matrix<T> &m, std::size_t nthreads) {
+            const std::size_t nblocks = (m.rows + block_rows - 1) / block_rows;
+            const std::size_t nslots = 2 * nthreads;
+            std::vector<std::size_t> widths(m.cols);
+            std::vector<std::string> slots(nslots);
+            std::vector<std::size_t> ready(nslots, std::numeric_limits<std::size_t>::max());
+            std::size_t measured{0}, written{0};
+            bool failed{false};
+            std::mutex mtx{};
+            std::condition_variable cv{};
+
+            // Waits for pred() and returns false, if another thread failed.
+            const auto wait = [&](auto pred) {
+                std::unique_lock lock{mtx};
+                cv.wait(lock, [&] { return failed || pred(); });
+                return !failed;
+            };
+            const auto signal = [&](auto update) {
+                {
+                    const std::lock_guard lock{mtx};
+                    update();
+                }
+                cv.notify_all();
+            };
+
+            internal::parallel_for(nthreads + 1, [&](std::size_t t) {
+                try {
+                    if (t == 0) {
+                        for (std::size_t b = 0; b < nblocks; ++b) {
+                            if (!wait([&] { return ready[b % nslots] == b; }))
+                                return;
+                            ctx.out.write(slots[b % nslots]);
+                            signal([&] { ++written; });
+                        }
+                        return;
+                    }
+
+                    const auto w = t - 1;
+                    internal::MatrixPrinter<T> p{ elem, ctx.args };
+                    std::vector<std::size_t> tw(m.cols);
+                    p.measure(m, m.rows * w / nthreads, m.rows * (w + 1) / nthreads, tw);
+                    signal([&] {
+                        std::ranges::transform(widths, tw, begin(widths), [](auto a, auto b) { return std::max(a, b); });
+                        ++measured;
+                    });
+                    if (!wait([&] { return measured == nthreads; }))
+                        return;
+
+                    for (std::size_t b = w; b < nblocks; b += nthreads) {
+                        if (!wait([&] { return b < written + nslots; }))
+                            return;
+                        auto &slot = slots[b % nslots];
+                        slot.clear();
+                        p.render(m, b * block_rows, std::min(m.rows, (b + 1) * block_rows), widths, slot);
+                        signal([&] { ready[b % nslots] = b; });
+                    }
+                } catch (...) {
+                    signal([&] { failed = true; });
+                    throw;
+                }
+            });
+        }
+#endif
+    };
+
+#if __cpp_lib_source_location >= 201907L
+    template<>
+    struct Formatter<std::source_location> : internal::PaddedFormatter {
+	void format_to(FormatContext &ctx, const std::source_location &loc) {
+	    auto &out = ctx.out;
+	    safmat::format_to(out, "{}:{}:{}", loc.file_name(), loc.line(), loc.column());
+	}
+    };
+#endif
+}
+
+// Compiled and resumable formatting.
+namespace safmat {
+    // Format string split into runs of literal text and replacement fields.
+    // The format string is referenced, not copied.
+    class CompiledFormat {
+    public:
+        struct Segment {
+            std::string_view text{};                    // literal text, or the whole field
+            bool field{false};
+            std::optional<std::size_t> index{};         // explicit argument index
+            std::optional<InputIterator> spec{};        // start of the format spec (after ':')
+        };
+    private:
+        std::vector<Segment> segs{};
+    public:
+        CompiledFormat(std::string_view fmt) {
+            auto it = begin(fmt);
+
+            const auto literal = [this](std::string_view s) {
+                if (!segs.empty() && !segs.back().field && segs.back().text.end() == s.begin()) {
+                    segs.back().text = { segs.back().text.begin(), s.end() };
+                } else {
+                    segs.push_back({ s });
+                }
+            };
+
+            while (it != end(fmt)) {
+                const auto start = it;
+                if (*it == '{') {
+                    ++it;
+
+                    if (*it == '{') {
+                        literal({ start, it++ });
+                        continue;
+                    }
+
+                    Segment seg{};
+                    seg.field = true;
+
+                    if (std::isdigit(*it)) {
+                        std::size_t idx{0};
+                        while (std::isdigit(*it))
+                            idx = idx * 10 + (*it++ - '0');
+                        seg.index = idx;
+                    }
+
+                    if (*it == ':') {
+                        seg.spec = ++it;
+                        internal::DeferredSpec{}.parse(it);
+                    }
+
+                    if (*it != '}')
+                        throw format_error("Expected '}'.");
+
+                    seg.text = { start, ++it };
+                    segs.push_back(seg);
+                } else if (*it == '}') {
+                    ++it;
+                    if (*it != '}')
+                        throw format_error("'}' must be escaped with '}'.");
+                    literal({ start, it++ });
+                } else {
+                    while (it != end(fmt) && *it != '{' && *it != '}')
+                        ++it;
+                    literal({ start, it });
+                }
+            }
+        }
+
+        std::span<const Segment> segments() const noexcept { return segs; }
+
+        // Selects the argument of a replacement field and parses its spec, exactly like xformat_to() does.
+        static const FormatArg &begin_field(FormatContext &ctx, const Segment &seg) {
+            auto &arg = ctx[seg.index.has_value() ? seg.index.value() : ctx.carg++];
+
+            arg.reset_fmt();
+
+            if (seg.spec.has_value()) {
+                auto it = seg.spec.value();
+                arg.parse(it);
+                if (*it != '}')
+                    throw format_error("Expected '}'.");
+            }
+            return arg;
+        }
+
+        // Formats a single replacement field.
+        static void format_field(FormatContext &ctx, const Segment &seg) {
+            begin_field(ctx, seg).format_to(ctx);
+        }
+    };
+
+    // Formatting state machine, which can be paused whenever the output is full and resumed later,
+    // eg. to format into the send buffer of a non-blocking socket.
+    // Literal text is written directly, a field is formatted into a buffer and drained from there.
+    // Containers and maps are formatted a few elements at a time, so about one block is buffered;
+    // any other field (eg. a matrix or a user-defined type) is buffered completely.
+    // The arguments are copied, the format string is only referenced.
+    template<class... Args>
+    class ResumableFormat {
+    private:
+        struct State {
+            CompiledFormat fmt;
+            std::array<FormatArg, sizeof...(Args)> argv;
+            // Fields are formatted alternately into one of two buffers, so the last chunk passed to write()
+            // (eg. the one held by FormatChunks) stays valid, while the next field is formatted.
+            std::array<io::ChunkedBuffer, 2> fields{};
+            std::size_t cur{0};
+            FormatContext ctx{ fields[0], argv };
+
+            std::size_t seg{0};
+            std::size_t pos{0};
+            io::ChunkedBuffer::iterator chunk{};
+            const FormatArg *arg{nullptr};      // the field being formatted
+            bool field_ready{false};
+            bool field_done{false};
+
+            template<class... Ts>
+            State(std::string_view fmt, Ts&&... args)
+                : fmt{fmt}, argv{ FormatArg{ Args{ std::forward<Ts>(args) } }... } {}
+        };
+
+        std::unique_ptr<State> state;
+
+        // Writes s[pos..] and returns true, if write() took all of it.
+        template<class W>
+        static bool drain(W &write, std::string_view s, std::size_t &pos) {
+            while (pos < s.size()) {
+                const std::size_t n = write(s.substr(pos));
+                if (n == 0)
+                    return false;
+                pos += n;
+            }
+            return true;
+        }
+    public:
+        template<class... Ts>
+        ResumableFormat(std::string_view fmt, Ts&&... args)
+            : state{ std::make_unique<State>(fmt, std::forward<Ts>(args)...) } {}
+
+        bool done() const noexcept { return state->seg == state->fmt.segments().size(); }
+
+        // write(std::string_view s) returns the number of bytes it accepted, 0 means the output is full.
+        // Returns true, once everything has been written.
+        template<class W>
+        bool resume(W write) {
+            auto &st = *state;
+            const auto segs = st.fmt.segments();
+
+            for (; st.seg < segs.size(); ++st.seg, st.pos = 0) {
+                const auto &seg = segs[st.seg];
+
+                if (!seg.field) {
+                    if (!drain(write, seg.text, st.pos))
+                        return false;
+                    continue;
+                }
+
+                do {
+                    if (!st.field_ready) {
+                        if (!st.fields[st.cur].empty())
+                            st.cur ^= 1;
+                        auto &field = st.fields[st.cur];
+                        field.clear();
+                        st.ctx.out = field;
+                        if (!st.arg)
+                            st.arg = &CompiledFormat::begin_field(st.ctx, seg);
+                        // Elements are batched up to about one block.
+                        do
+                            st.field_done = st.arg->format_step(st.ctx);
+                        while (!st.field_done && field.size() < io::ChunkedBuffer::block_size);
+                        st.chunk = field.begin();
+                        st.field_ready = true;
+                    }
+
+                    for (; st.chunk != st.fields[st.cur].end(); ++st.chunk, st.pos = 0) {
+                        if (!drain(write, *st.chunk, st.pos))
+                            return false;
+                    }
+                    st.field_ready = false;
+                } while (!st.field_done);
+                st.arg = nullptr;
+            }
+
+            return true;
+        }
+
+        // Fills dst as far as possible and returns the number of written bytes.
+        std::size_t read(std::span<char> dst) {
+            std::size_t n{0};
+            resume([&](std::string_view s) {
+                const auto m = std::min(s.size(), dst.size() - n);
+                std::memcpy(dst.data() + n, s.data(), m);
+                n += m;
+                return m;
+            });
+            return n;
+        }
+    };
+
+    template<class... Args>
+    ResumableFormat(std::string_view, Args&&...) -> ResumableFormat<std::decay_t<Args>...>;
+
+    // Lazy input range of output chunks, which are only formatted when the range is advanced.
+    // Chunks are views into the format string or into a field buffer and are valid until the next increment.
+    // Like ResumableFormat, it buffers at most about one block of a container or map field,
+    // but any other field as a whole.
+    template<class... Args>
+    class FormatChunks {
+    private:
+        ResumableFormat<Args...> rf;
+        std::string_view chunk{};
+        bool started{false};
+
+        void next() {
+            chunk = {};
+            rf.resume([this](std::string_view s) -> std::size_t {
+                if (!chunk.empty())
+                    return 0;
+                chunk = s;
+                return s.size();
+            });
+        }
+    public:
+        class iterator {
+        private:
+            FormatChunks *r;
+        public:
+            using value_type = std::string_view;
+            using difference_type = std::ptrdiff_t;
+
+            iterator(FormatChunks *r = nullptr) noexcept : r(r) {}
+
+            std::string_view operator*() const noexcept { return r->chunk; }
+            iterator &operator++() {
+                r->next();
+                return *this;
+            }
+            void operator++(int) { ++*this; }
+            bool operator==(std::default_sentinel_t) const noexcept { return r->chunk.empty(); }
+        };
+
+        template<class... Ts>
+        FormatChunks(std::string_view fmt, Ts&&... args) : rf{ fmt, std::forward<Ts>(args)... } {}
+
+        iterator begin() {
+            if (!started) {
+                started = true;
+                next();
+            }
+            return { this };
+        }
+        std::default_sentinel_t end() const noexcept { return {}; }
+    };
+
+    template<class... Args>
+    FormatChunks<std::decay_t<Args>...> format_chunks(std::string_view fmt, Args&&... args) {
+        return { fmt, std::forward<Args>(args)... };
+    }
+}
+
+#if SAFMAT_ASYNC
+// Asynchronous printing with coroutines.
+namespace safmat::io {
+    // Sink for async_print().
+    // try_write() writes as much as possible without blocking and returns the number of written bytes.
+    // writable() returns an awaitable, which is resumed (eg. by an epoll loop) once try_write() can make progress again.
+    template<class S>
+    concept AsyncSink = requires (S &sink, std::string_view s) {
+        { sink.try_write(s) } -> std::convertible_to<std::size_t>;
+        sink.writable();
+    };
+}
+
+namespace safmat {
+    // Lazily started coroutine, which can be co_await'ed or started with start().
+    class AsyncTask {
+    public:
+        struct promise_type;
+        using handle_type = std::coroutine_handle<promise_type>;
+
+        struct promise_type {
+            std::coroutine_handle<> continuation{};
+            std::exception_ptr error{};
+
+            AsyncTask get_return_object() noexcept { return AsyncTask{ handle_type::from_promise(*this) }; }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            auto final_suspend() noexcept {
+                struct FinalAwaiter {
+                    bool await_ready() noexcept { return false; }
+                    std::coroutine_handle<> await_suspend(handle_type h) noexcept {
+                        const auto c = h.promise().continuation;
+                        return c ? c : std::noop_coroutine();
+                    }
+                    void await_resume() noexcept {}
+                };
+                return FinalAwaiter{};
+            }
+            void return_void() noexcept {}
+            void unhandled_exception() noexcept { error = std::current_exception(); }
+        };
+    private:
+        handle_type h;
+    public:
+        explicit AsyncTask(handle_type h) noexcept : h(h) {}
+        AsyncTask(AsyncTask &&t) noexcept : h(std::exchange(t.h, {})) {}
+        AsyncTask &operator=(AsyncTask &&t) noexcept {
+            std::swap(h, t.h);
+            return *this;
+        }
+        ~AsyncTask() {
+            if (h)
+                h.destroy();
+        }
+
+        bool done() const noexcept { return !h || h.done(); }
+
+        // Runs the task until it has to wait for the first time.
+        void start() { h.resume(); }
+
+        // Rethrows the exception of a finished task, if any.
+        void result() const {
+            if (h && h.promise().error)
+                std::rethrow_exception(h.promise().error);
+        }
+
+        auto operator co_await() const noexcept {
+            struct Awaiter {
+                handle_type h;
+
+                bool await_ready() const noexcept { return !h || h.done(); }
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<> c) noexcept {
+                    h.promise().continuation = c;
+                    return h;
+                }
+                void await_resume() const {
+                    if (h && h.promise().error)
+                        std::rethrow_exception(h.promise().error);
+                }
+            };
+            return Awaiter{ h };
+        }
+    };
+
+    // Formats directly into the sink and waits with co_await, whenever it is full.
+    // The arguments are copied into the coroutine frame, the format string must outlive the task.
+    template<io::AsyncSink S, class... Args>
+    AsyncTask async_print(S &sink, std::string_view fmt, Args... args) {
+        ResumableFormat<Args...> rf{ fmt, std::move(args)... };
+        while (!rf.resume([&sink](std::string_view s) -> std::size_t { return sink.try_write(s); }))
+            co_await sink.writable();
+    }
+
+    template<io::AsyncSink S, class... Args>
+    AsyncTask async_println(S &sink, std::string_view fmt, Args... args) {
+        co_await async_print(sink, fmt, std::move(args)...);
+        co_await async_print(sink, "\n");
+    }
+}
+#endif // SAFMAT_ASYNC
+
+#if SAFMAT_BINLOG
+// Binary logging: records are written without formatting and rendered later by safmat-decode.
+//
+// File layout (native byte order):
+//   header:  "SAFMATBL" u32 version
+//   'F' u32 id u32 len char[len]                   format string, written before its first use
+//   'R' u32 id u8 nargs { u8 tag, payload }...     record
+namespace safmat::binlog {
+    inline constexpr char magic[8] = { 'S', 'A', 'F', 'M', 'A', 'T', 'B', 'L' };
+    inline constexpr std::uint32_t version = 1;
+
+    enum class Tag : std::uint8_t {
+        Bool = 1,       // u8
+        Char,           // char
+        Signed,         // i64
+        Unsigned,       // u64
+        Float,          // f32
+        Double,         // f64
+        String,         // u32 len, char[len]
+        Signed128,      // i128
+        Unsigned128,    // u128
+    };
+
+    // Arguments of other types are formatted with "{}" when logging and stored as a string,
+    // so their spec must be valid for a string (eg. "{:>10}"). Writer::log() rejects other specs.
+    using Value = std::variant<bool, char, std::int64_t, std::uint64_t, float, double, std::string
+#ifdef __SIZEOF_INT128__
+        , internal::int128, internal::uint128
+#endif
+        >;
+
+    // Renders a record the same way for Writer::log()'s check and Reader::next().
+    inline void render(const Output &out, std::string_view fmt, const std::vector<Value> &values) {
+        std::vector<FormatArg> argv{};
+        argv.reserve(values.size());
+        for (const auto &v : values)
+            std::visit([&argv](const auto &x) { argv.emplace_back(x); }, v);
+
+        FormatContext ctx{ out, argv };
+        xformat_to(ctx, fmt);
+    }
+
+    // 128-bit integers are std::integral only in GNU mode (-std=gnu++20), but always have their own tags.
+    template<class T>
+    concept Int128 =
+#ifdef __SIZEOF_INT128__
+        std::same_as<T, internal::int128> || std::same_as<T, internal::uint128>;
+#else
+        false;
+#endif
+
+    class Writer {
+    private:
+        struct Hash : std::hash<std::string_view> {
+            using is_transparent = void;
+        };
+
+        // One per combination of argument types.
+        template<class... Args>
+        static constexpr char types_key{};
+
+        FILE *file;
+        std::mutex mtx{};
+        std::unordered_map<std::string, std::uint32_t, Hash, std::equal_to<>> ids{};
+        std::vector<std::vector<const void *>> checked{};     // by format id: the checked types_key<>s
+        std::string buf{};
+
+        template<class T>
+        void put(const T &x) {
+            buf.append(reinterpret_cast<const char *>(&x), sizeof x);
+        }
+        void put(Tag tag) { buf += static_cast<char>(tag); }
+        void put_string(std::string_view s) {
+            put(static_cast<std::uint32_t>(s.size()));
+            buf += s;
+        }
+
+        template<class T>
+        void put_arg(const T &x) {
+            if constexpr (std::same_as<T, bool>) {
+                put(Tag::Bool);
+                put(static_cast<std::uint8_t>(x));
+            } else if constexpr (std::same_as<T, char>) {
+                put(Tag::Char);
+                put(x);
+            } else if constexpr (Int128<T>) {
+                put(std::same_as<T, internal::int128> ? Tag::Signed128 : Tag::Unsigned128);
+                put(x);
+            } else if constexpr (std::signed_integral<T> && sizeof (T) <= 8) {
+                put(Tag::Signed);
+                put(static_cast<std::int64_t>(x));
+            } else if constexpr (std::unsigned_integral<T> && sizeof (T) <= 8) {
+                put(Tag::Unsigned);
+                put(static_cast<std::uint64_t>(x));
+            } else if constexpr (std::same_as<T, float>) {
+                put(Tag::Float);
+                put(x);
+            } else if constexpr (std::floating_point<T>) {
+                put(Tag::Double);
+                put(static_cast<double>(x));
+            } else if constexpr (std::is_convertible_v<const T &, std::string_view>) {
+                put(Tag::String);
+                put_string(x);
+            } else {
+                put(Tag::String);
+                put_string(format("{}", x));
+            }
+        }
+
+        // The Value, that Reader sees for x.
+        template<class T>
+        static Value to_value(const T &x) {
+            if constexpr (std::same_as<T, bool> || std::same_as<T, char> || std::same_as<T, float> || Int128<T>) {
+                return x;
+            } else if constexpr (std::signed_integral<T> && sizeof (T) <= 8) {
+                return static_cast<std::int64_t>(x);
+            } else if constexpr (std::unsigned_integral<T> && sizeof (T) <= 8) {
+                return static_cast<std::uint64_t>(x);
+            } else if constexpr (std::floating_point<T>) {
+                return static_cast<double>(x);
+            } else if constexpr (std::is_convertible_v<const T &, std::string_view>) {
+                return std::string{std::string_view{x}};
+            } else {
+                return format("{}", x);
+            }
+        }
+    public:
+        // The file is not owned and should be opened in binary mode.
+        Writer(FILE *file) : file{file} {
+            std::fwrite(magic, 1, sizeof magic, file);
+            std::fwrite(&version, sizeof version, 1, file);
+        }
+
+        template<class... Args>
+        void log(std::string_view fmt, const Args &...args) {
+            static_assert(sizeof...(Args) < 256, "Too many arguments.");
+
+            const std::lock_guard lock{mtx};
+            buf.clear();
+
+            // Invalid specs are only noticed, when rendering, so the record is rendered like Reader would,
+            // once for each format string and combination of argument types, before anything is written.
+            auto it = ids.find(fmt);
+            const bool known = it != ids.end();
+            if (!known || std::ranges::find(checked[it->second], &types_key<Args...>) == checked[it->second].end()) {
+                io::Counter counter{};
+                render(counter, fmt, { to_value(args)... });
+
+                if (!known) {
+                    it = ids.emplace(fmt, static_cast<std::uint32_t>(ids.size())).first;
+                    checked.emplace_back();
+                    buf += 'F';
+                    put(it->second);
+                    put_string(fmt);
+                }
+                checked[it->second].push_back(&types_key<Args...>);
+            }
+
+            buf += 'R';
+            put(it->second);
+            put(static_cast<std::uint8_t>(sizeof...(Args)));
+            (put_arg(args), ...);
+
+            std::fwrite(buf.data(), 1, buf.size(), file);
+        }
+
+        void flush() {
+            const std::lock_guard lock{mtx};
+            std::fflush(file);
+        }
+    };
+
+    // Thrown by Reader::next(), if a record can't be rendered (eg. written by a different version).
+    // The record has been consumed, so reading can continue with the next one.
+    class record_error : public format_error {
+    public:
+        using format_error::format_error;
+    };
+
+    // Renders the records of a binary log with the same Formatter<T>'s, that format() would use.
+    class Reader {
+    private:
+        FILE *file;
+        std::vector<std::string> fmts{};
+        std::vector<Value> values{};
+        std::string line{};
+
+        template<class T>
+        T get() {
+            T x;
+            if (std::fread(&x, sizeof x, 1, file) != 1)
+                throw format_error{"Truncated binary log."};
+            return x;
+        }
+        std::string get_string() {
+            std::string s(get<std::uint32_t>(), '\0');
+            if (!s.empty() && std::fread(s.data(), 1, s.size(), file) != s.size())
+                throw format_error{"Truncated binary log."};
+            return s;
+        }
+        Value get_value() {
+            switch (static_cast<Tag>(get<std::uint8_t>())) {
+            case Tag::Bool:
+                return get<std::uint8_t>() != 0;
+            case Tag::Char:
+                return get<char>();
+            case Tag::Signed:
+                return get<std::int64_t>();
+            case Tag::Unsigned:
+                return get<std::uint64_t>();
+            case Tag::Float:
+                return get<float>();
+            case Tag::Double:
+                return get<double>();
+            case Tag::String:
+                return get_string();
+#ifdef __SIZEOF_INT128__
+            case Tag::Signed128:
+                return get<internal::int128>();
+            case Tag::Unsigned128:
+                return get<internal::uint128>();
+#endif
+            default:
+                throw format_error{"Invalid argument type in binary log."};
+            }
+        }
+    public:
+        // Reads and checks the header.
+        Reader(FILE *file) : file{file} {
+            char m[sizeof magic];
+            if (std::fread(m, 1, sizeof m, file) != sizeof m || std::memcmp(m, magic, sizeof m) != 0)
+                throw format_error{"Not a binary log."};
+            if (get<std::uint32_t>() != version)
+                throw format_error{"Unsupported binary log version."};
+        }
+
+        // Renders the next record into out, followed by end. Returns false at the end of the file.
+        // Throws record_error for a record, that can't be rendered, and format_error for a corrupt file.
+        bool next(const Output &out, std::string_view end = "\n") {
+            while (true) {
+                const int type = std::fgetc(file);
+                if (type == EOF) {
+                    return false;
+                } else if (type == 'F') {
+                    const auto id = get<std::uint32_t>();
+                    if (id >= fmts.size())
+                        fmts.resize(id + 1);
+                    fmts[id] = get_string();
+                } else if (type == 'R') {
+                    break;
+                } else {
+                    throw format_error{"Invalid record in binary log."};
+                }
+            }
+
+            const auto id = get<std::uint32_t>();
+            if (id >= fmts.size())
+                throw format_error{"Unknown format string in binary log."};
+
+            values.clear();
+            for (auto n = get<std::uint8_t>(); n != 0; --n)
+                values.push_back(get_value());
+
+            // The record is rendered completely, before anything is written.
+            line.clear();
+            try {
+                render(line, fmts[id], values);
+            } catch (const format_error &e) {
+                throw record_error{e.what()};
+            }
+            line += end;
+            out.write(line);
+            return true;
+        }
+    };
+}
+#endif // SAFMAT_BINLOG
+
+// Helpers for outputs, that work with complete lines.
+namespace safmat::internal {
+    // The incomplete lines of every thread, that writes to an output.
+    // The buffers belong to the output, so they are freed together with it, and an output, which is later
+    // created at the same address, doesn't inherit them. Every instance has an id, that is never reused,
+    // under which each thread caches its own buffer.
+    class LineStaging {
+    private:
+        using Buffer = std::shared_ptr<std::string>;
+
+        static inline std::atomic<std::uint64_t> next_id{0};
+
+        std::uint64_t id{next_id.fetch_add(1, std::memory_order_relaxed)};
+        std::mutex mtx{};
+        std::vector<Buffer> buffers{};
+    public:
+        LineStaging() = default;
+        LineStaging(const LineStaging &) = delete;
+        LineStaging &operator=(const LineStaging &) = delete;
+
+        // The partial lines move with the output, the moved-from staging starts empty.
+        LineStaging(LineStaging &&l) noexcept
+            : id{std::exchange(l.id, next_id.fetch_add(1, std::memory_order_relaxed))}, buffers{std::exchange(l.buffers, {})} {}
+        LineStaging &operator=(LineStaging &&l) noexcept {
+            std::swap(id, l.id);
+            std::swap(buffers, l.buffers);
+            return *this;
+        }
+
+        // The current thread's incomplete line.
+        std::string &buffer() {
+            // A buffer is shared by the output and the cache of its thread, so if either is the only owner left,
+            // the other one is gone: the output was destroyed or the thread has exited.
+            thread_local std::vector<std::pair<std::uint64_t, Buffer>> cache{};
+            for (const auto &[i, buf] : cache) {
+                if (i == id)
+                    return *buf;
+            }
+            std::erase_if(cache, [](const auto &c) { return c.second.use_count() == 1; });
+
+            auto buf = std::make_shared<std::string>();
+            {
+                const std::lock_guard lock{mtx};
+                std::erase_if(buffers, [](const Buffer &b) { return b.use_count() == 1 && b->empty(); });
+                buffers.push_back(buf);
+            }
+            return *cache.emplace_back(id, std::move(buf)).second;
+        }
+
+        // Collects s in the current thread's buffer and passes every completed line (including the '\n') to commit(),
+        // so that lines of different threads are never interleaved.
+        template<class F>
+        void write(std::string_view s, F commit) {
+            auto &buf = buffer();
+            while (!s.empty()) {
+                const auto nl = s.find('\n');
+                if (nl == std::string_view::npos) {
+                    buf += s;
+                    return;
+                }
+
+                if (buf.empty()) {
+                    commit(s.substr(0, nl + 1));
+                } else {
+                    buf += s.substr(0, nl + 1);
+                    commit(std::string_view{buf});
+                    buf.clear();
+                }
+                s.remove_prefix(nl + 1);
+            }
+        }
+
+        // Terminates the incomplete lines of all threads with '\n' and passes them to commit().
+        // Outputs call this in their destructor, when no thread writes anymore.
+        template<class F>
+        void drain(F commit) {
+            const std::lock_guard lock{mtx};
+            for (auto &buf : buffers) {
+                if (buf->empty())
+                    continue;
+                *buf += '\n';
+                commit(std::string_view{*buf});
+                buf->clear();
+            }
+        }
+    };
+}
+
+#if SAFMAT_OUT_MMAP
+namespace safmat::io {
+    // Ring buffer in a memory-mapped file.
+    // Complete lines are copied into the mapping at a lock-free write cursor. They survive a crash of the process,
+    // because the kernel writes the page cache back to the file, without paying for fsync().
+    class MmapRing {
+    public:
+        struct Header {
+            char magic[8];
+            std::uint32_t version;
+            std::uint32_t header_size;
+            std::uint64_t capacity;
+            std::atomic<std::uint64_t> head;    // number of bytes ever written
+        };
+        static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+
+        static constexpr char magic[8] = { 'S', 'A', 'F', 'M', 'A', 'T', 'R', 'G' };
+        static constexpr std::uint32_t version = 1;
+        static constexpr std::size_t header_size = 4096;
+    private:
+        char *map{nullptr};
+        std::size_t cap{0};
+        internal::LineStaging lines{};
+
+        Header *header() const noexcept { return reinterpret_cast<Header *>(map); }
+        char *data() const noexcept { return map + header_size; }
+
+        [[noreturn]] static void fail(const char *what) {
+            throw std::system_error{errno, std::generic_category(), what};
+        }
+    public:
+        // Opens the ring file, keeping its content, if it has the same capacity.
+        MmapRing(const char *path, std::size_t capacity) : cap{capacity} {
+            if (cap == 0)
+                throw std::system_error{EINVAL, std::generic_category(), "MmapRing: zero capacity"};
+
+            const int fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+            if (fd < 0)
+                fail("open()");
+
+            struct stat st;
+            const bool reuse = ::fstat(fd, &st) == 0 && static_cast<std::size_t>(st.st_size) == header_size + cap;
+            if (!reuse && ::ftruncate(fd, header_size + cap) != 0) {
+                ::close(fd);
+                fail("ftruncate()");
+            }
+
+            void *p = ::mmap(nullptr, header_size + cap, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (p == MAP_FAILED)
+                fail("mmap()");
+            map = static_cast<char *>(p);
+
+            auto h = header();
+            if (!reuse || std::memcmp(h->magic, magic, sizeof magic) != 0 || h->version != version || h->capacity != cap) {
+                std::memset(map, 0, header_size + cap);
+                std::memcpy(h->magic, magic, sizeof magic);
+                h->version = version;
+                h->header_size = header_size;
+                h->capacity = cap;
+                h->head.store(0);
+            }
+        }
+        MmapRing(const MmapRing &) = delete;
+        MmapRing &operator=(const MmapRing &) = delete;
+        ~MmapRing() {
+            lines.drain([this](std::string_view line) { write_line(line); });
+            ::munmap(map, header_size + cap);
+        }
+
+        void write_line(std::string_view line) noexcept {
+            if (line.size() > cap)
+                line.remove_prefix(line.size() - cap);
+
+            const auto pos = header()->head.fetch_add(line.size(), std::memory_order_relaxed) % cap;
+            const auto n = std::min(line.size(), cap - pos);
+            std::memcpy(data() + pos, line.data(), n);
+            std::memcpy(data(), line.data() + n, line.size() - n);
+        }
+
+        void write(std::string_view s) {
+            lines.write(s, [this](std::string_view line) { write_line(line); });
+        }
+
+        // Returns the complete lines of a ring file in order, oldest first.
+        // Lines, that were being written during a crash, may be garbled.
+        static std::string recover(const char *path) {
+            const int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+                fail("open()");
+
+            struct stat st;
+            if (::fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < header_size) {
+                ::close(fd);
+                throw format_error{"Not a ring file."};
+            }
+
+            void *p = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (p == MAP_FAILED)
+                fail("mmap()");
+
+            const auto map = static_cast<const char *>(p);
+            const auto h = reinterpret_cast<const Header *>(map);
+            if (std::memcmp(h->magic, magic, sizeof magic) != 0 || h->version != version || h->capacity == 0
+                || h->header_size + h->capacity != static_cast<std::size_t>(st.st_size)) {
+                ::munmap(p, st.st_size);
+                throw format_error{"Not a ring file."};
+            }
+
+            const auto data = map + h->header_size;
+            const auto cap = h->capacity;
+            const auto head = h->head.load();
+            const auto len = std::min<std::uint64_t>(head, cap);
+            const auto start = (head - len) % cap;
+
+            std::string s{};
+            s.reserve(len);
+            s.append(data + start, std::min(len, cap - start));
+            s.append(data, len - std::min(len, cap - start));
+            ::munmap(p, st.st_size);
+
+            // Drop the partially overwritten oldest line and bytes, that were never written.
+            if (head > cap)
+                s.erase(0, s.find('\n') + 1);
+            std::erase(s, '\0');
+            return s;
+        }
+    };
+
+    template<>
+    struct OutputAdapter<MmapRing> {
+        inline static void write(MmapRing *out, std::string_view s) {
+            out->write(s);
+        }
+    };
+}
+#endif // SAFMAT_OUT_MMAP
+
+#if SAFMAT_OUT_SHM
+namespace safmat::io {
+    // Multi-producer, single-consumer ring of lines in shared memory.
+    // Worker processes (and threads) write complete lines without any syscall or lock,
+    // a collector process drains them with read(), eg. into a file with large writes.
+    // Lines are dropped (and counted), while the ring is full.
+    // A line, that has been reserved but not committed for stall_timeout (eg. because its worker crashed),
+    // is skipped and counted as dropped. The collector still waits forever for a worker, that died in the
+    // few instructions between reserving a line and announcing its size, and a worker, that is merely
+    // stopped for longer than stall_timeout while writing a line, may corrupt a later one.
+    class ShmRing {
+    public:
+        struct Header {
+            char magic[8];
+            std::uint64_t capacity;
+            alignas(64) std::atomic<std::uint64_t> tail;    // reserved by writers
+            alignas(64) std::atomic<std::uint64_t> head;    // consumed by the collector
+            alignas(64) std::atomic<std::uint64_t> dropped;
+        };
+        static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+
+        static constexpr char magic[8] = { 'S', 'A', 'F', 'M', 'A', 'T', 'S', 'R' };
+        static constexpr std::size_t header_size = 4096;
+
+        // Used by read() only.
+        std::chrono::steady_clock::duration stall_timeout{std::chrono::seconds{1}};
+    private:
+        // Each record starts with a 32-bit word: committed flag, padding flag, reserved flag and size.
+        // A writer announces the size with the reserved flag right after reserving the record and commits it last.
+        static constexpr std::uint32_t committed = 1u << 31;
+        static constexpr std::uint32_t padding = 1u << 30;
+        static constexpr std::uint32_t reserved = 1u << 29;
+        static constexpr std::uint32_t size_mask = reserved - 1;
+
+        char *map{nullptr};
+        std::size_t cap{0};
+        int fd{-1};
+        internal::LineStaging lines{};
+        std::uint64_t stalled_pos{~std::uint64_t{0}};   // the uncommitted record, read() waits for
+        std::chrono::steady_clock::time_point stalled_since{};
+
+        Header *header() const noexcept { return reinterpret_cast<Header *>(map); }
+        char *data() const noexcept { return map + header_size; }
+        std::atomic_ref<std::uint32_t> word(std::uint64_t off) const noexcept {
+            return std::atomic_ref<std::uint32_t>{ *reinterpret_cast<std::uint32_t *>(data() + off) };
+        }
+        static constexpr std::uint64_t record_size(std::size_t len) noexcept { return 8 + ((len + 7) & ~std::uint64_t{7}); }
+
+        [[noreturn]] static void fail(const char *what) {
+            throw std::system_error{errno, std::generic_category(), what};
+        }
+
+        static void check_capacity(std::size_t capacity) {
+            if (capacity == 0)
+                throw std::system_error{EINVAL, std::generic_category(), "ShmRing: zero capacity"};
+        }
+
+        void map_fd(std::size_t size) {
+            void *p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED)
+                fail("mmap()");
+            map = static_cast<char *>(p);
+        }
+        void init(std::size_t capacity) {
+            cap = (capacity + 7) & ~std::size_t{7};
+            if (::ftruncate(fd, header_size + cap) != 0)
+                fail("ftruncate()");
+            map_fd(header_size + cap);
+
+            auto h = new (map) Header{};
+            std::memcpy(h->magic, magic, sizeof magic);
+            h->capacity = cap;
+        }
+        void attach() {
+            struct stat st;
+            if (::fstat(fd, &st) != 0)
+                fail("fstat()");
+            if (static_cast<std::size_t>(st.st_size) < header_size)
+                throw format_error{"Not a shared memory ring."};
+
+            map_fd(st.st_size);
+            cap = header()->capacity;
+            if (std::memcmp(header()->magic, magic, sizeof magic) != 0 || cap == 0 || header_size + cap != static_cast<std::size_t>(st.st_size))
+                throw format_error{"Not a shared memory ring."};
+        }
+    public:
+        // Creates a new named ring with shm_open().
+        ShmRing(const char *name, std::size_t capacity) {
+            check_capacity(capacity);
+            fd = ::shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+            if (fd < 0)
+                fail("shm_open()");
+            init(capacity);
+        }
+
+        // Opens an existing named ring.
+        explicit ShmRing(const char *name) {
+            fd = ::shm_open(name, O_RDWR, 0);
+            if (fd < 0)
+                fail("shm_open()");
+            attach();
+        }
+
+        // Creates an anonymous ring, which is shared with fork()'ed children or by passing get_fd() to other processes.
+        explicit ShmRing(std::size_t capacity) {
+            check_capacity(capacity);
+            fd = ::memfd_create("safmat-ring", MFD_CLOEXEC);
+            if (fd < 0)
+                fail("memfd_create()");
+            init(capacity);
+        }
+
+        // Opens a ring from a file descriptor returned by get_fd().
+        static ShmRing from_fd(int fd) {
+            ShmRing r{};
+            r.fd = ::dup(fd);
+            if (r.fd < 0)
+                fail("dup()");
+            r.attach();
+            return r;
+        }
+
+        ShmRing(ShmRing &&r) noexcept
+            : stall_timeout{r.stall_timeout}, map{std::exchange(r.map, nullptr)}, cap{std::exchange(r.cap, 0)},
+              fd{std::exchange(r.fd, -1)}, lines{std::move(r.lines)}, stalled_pos{r.stalled_pos}, stalled_since{r.stalled_since} {}
+        ShmRing &operator=(ShmRing &&r) noexcept {
+            stall_timeout = r.stall_timeout;
+            std::swap(map, r.map);
+            std::swap(cap, r.cap);
+            std::swap(fd, r.fd);
+            lines = std::move(r.lines);
+            stalled_pos = r.stalled_pos;
+            stalled_since = r.stalled_since;
+            return *this;
+        }
+        ~ShmRing() {
+            if (map) {
+                lines.drain([this](std::string_view line) { write_line(line); });
+                ::munmap(map, header_size + cap);
+            }
+            if (fd >= 0)
+                ::close(fd);
+        }
+
+        static void unlink(const char *name) { ::shm_unlink(name); }
+
+        int get_fd() const noexcept { return fd; }
+        std::uint64_t dropped() const noexcept { return header()->dropped.load(std::memory_order_relaxed); }
+
+        bool write_line(std::string_view line) noexcept {
+            auto h = header();
+            const auto need = record_size(line.size());
+            if (line.size() > size_mask || need > cap) {
+                h->dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+
+            // Reserve space, skipping the end of the ring, if the record doesn't fit there.
+            auto t = h->tail.load(std::memory_order_relaxed);
+            std::uint64_t off, pad;
+            do {
+                off = t % cap;
+                pad = off + need > cap ? cap - off : 0;
+                if (t + pad + need - h->head.load(std::memory_order_acquire) > cap) {
+                    h->dropped.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+            } while (!h->tail.compare_exchange_weak(t, t + pad + need, std::memory_order_relaxed));
+
+            if (pad != 0) {
+                word(off).store(committed | padding | static_cast<std::uint32_t>(pad - 8), std::memory_order_release);
+                off = 0;
+            }
+
+            const auto size = static_cast<std::uint32_t>(line.size());
+            word(off).store(reserved | size, std::memory_order_relaxed);
+            std::memcpy(data() + off + 8, line.data(), line.size());
+
+            // Fails, if the collector has given up on this record already (and counted it as dropped).
+            auto w = reserved | size;
+            return word(off).compare_exchange_strong(w, committed | size, std::memory_order_release, std::memory_order_relaxed);
+        }
+
+        void write(std::string_view s) {
+            lines.write(s, [this](std::string_view line) { write_line(line); });
+        }
+
+        // Appends all committed lines in order to out and returns the number of appended bytes.
+        // Must only be called by a single collector.
+        std::size_t read(std::string &out) {
+            auto h = header();
+            auto pos = h->head.load(std::memory_order_relaxed);
+            std::size_t n{0};
+
+            while (true) {
+                const auto off = pos % cap;
+                auto w = word(off).load(std::memory_order_acquire);
+                if (!(w & committed)) {
+                    if (!(w & reserved))
+                        break;
+
+                    const auto now = std::chrono::steady_clock::now();
+                    if (pos != stalled_pos) {
+                        stalled_pos = pos;
+                        stalled_since = now;
+                    }
+                    if (now - stalled_since < stall_timeout)
+                        break;
+
+                    // Give up on the record, unless it has been committed in the meantime.
+                    if (!word(off).compare_exchange_strong(w, 0, std::memory_order_acquire))
+                        continue;
+                    h->dropped.fetch_add(1, std::memory_order_relaxed);
+                }
+
+                const std::size_t size = w & size_mask;
+                const auto total = (w & padding) ? size + 8 : record_size(size);
+                if ((w & (committed | padding)) == committed) {
+                    out.append(data() + off + 8, size);
+                    n += size;
+                }
+
+                // Clear the record, so that no stale word is mistaken for a committed record later.
+                std::memset(data() + off + 8, 0, total - 8);
+                word(off).store(0, std::memory_order_relaxed);
+                pos += total;
+            }
+
+            h->head.store(pos, std::memory_order_release);
+            return n;
+        }
+    private:
+        ShmRing() = default;
+    };
+
+    template<>
+    struct OutputAdapter<ShmRing> {
+        inline static void write(ShmRing *out, std::string_view s) {
+            out->write(s);
+        }
+    };
+}
+#endif // SAFMAT_OUT_SHM
+
+#if SAFMAT_OUT_SYSLOG || SAFMAT_OUT_PREFIX
+namespace safmat::internal {
+    inline char *put_digits(char *p, unsigned x, int n) noexcept {
+        for (int i = n - 1; i >= 0; --i, x /= 10)
+            p[i] = static_cast<char>('0' + x % 10);
+        return p + n;
+    }
+
+    // Renders RFC 3339 UTC timestamps, eg. "2026-10-18T12:34:56.123456Z".
+    // The date and time of day are only re-rendered, when the second changes.
+    class TimestampCache {
+    private:
+        std::chrono::sys_seconds sec{std::chrono::sys_seconds::min()};
+        char buf[28]{};
+    public:
+        std::string_view operator()(std::chrono::system_clock::time_point tp) noexcept {
+            using namespace std::chrono;
+
+            const auto s = floor<seconds>(tp);
+            if (s != sec) {
+                sec = s;
+                const auto days = floor<std::chrono::days>(s);
+                const year_month_day ymd{days};
+                const hh_mm_ss hms{s - days};
+
+                auto p = put_digits(buf, static_cast<unsigned>(static_cast<int>(ymd.year())), 4);
+                *p++ = '-';
+                p = put_digits(p, static_cast<unsigned>(ymd.month()), 2);
+                *p++ = '-';
+                p = put_digits(p, static_cast<unsigned>(ymd.day()), 2);
+                *p++ = 'T';
+                p = put_digits(p, hms.hours().count(), 2);
+                *p++ = ':';
+                p = put_digits(p, hms.minutes().count(), 2);
+                *p++ = ':';
+                p = put_digits(p, hms.seconds().count(), 2);
+                *p++ = '.';
+                buf[26] = 'Z';
+            }
+
+            put_digits(buf + 20, static_cast<unsigned>(duration_cast<microseconds>(tp - s).count()), 6);
+            return { buf, 27 };
+        }
+    };
+}
+
+#endif
+
+#if SAFMAT_OUT_SYSLOG
+namespace safmat::io {
+    // Sends lines as RFC 5424 messages over a Unix domain datagram socket (eg. to a local syslog daemon).
+    // Messages are batched and sent with a single sendmmsg(), once batch_size messages are queued,
+    // when a message is logged more than max_delay after the oldest queued one, or when flush() is called.
+    // An idle sink doesn't send its queued messages by itself, so call flush() periodically (eg. from an event loop).
+    class SyslogSink {
+    public:
+        int facility{1};                // user-level messages
+        int severity{6};                // informational
+        std::size_t batch_size{64};
+        std::chrono::milliseconds max_delay{100};
+    private:
+        int fd{-1};
+        bool owned{false};
+        std::string origin{};           // " HOSTNAME APP-NAME "
+        std::string header_tail{};      // " HOSTNAME APP-NAME PROCID - - "
+        unsigned generation{0};         // fork_generation() when header_tail was rendered
+        std::atomic<std::uint64_t> n_dropped{0};
+        internal::LineStaging lines{};
+
+        std::mutex mtx{};
+        internal::TimestampCache timestamp{};
+        std::chrono::system_clock::time_point oldest{};
+        std::string buf{};
+        std::vector<std::pair<std::size_t, std::size_t>> msgs{};
+        std::vector<iovec> iovs{};
+        std::vector<mmsghdr> hdrs{};
+
+        // Number of fork()s, that led to this process, so a child re-reads its process id.
+        static unsigned fork_generation() noexcept {
+            static std::atomic<unsigned> forks{0};
+            [[maybe_unused]] static const int registered = ::pthread_atfork(nullptr, nullptr, [] {
+                forks.fetch_add(1, std::memory_order_relaxed);
+            });
+            return forks.load(std::memory_order_relaxed);
+        }
+
+        void render_header() {
+            generation = fork_generation();
+            header_tail = format("{}{} - - ", origin, ::getpid());
+        }
+
+        void init(std::string_view app_name) {
+            char host[256]{};
+            if (::gethostname(host, sizeof host - 1) != 0 || !*host)
+                host[0] = '-';
+            origin = format(" {} {} ", host, app_name.empty() ? "-" : app_name);
+            render_header();
+        }
+
+        void flush_locked() noexcept {
+            iovs.resize(msgs.size());
+            hdrs.resize(msgs.size());
+            for (std::size_t i = 0; i < msgs.size(); ++i) {
+                iovs[i] = { buf.data() + msgs[i].first, msgs[i].second };
+                hdrs[i] = {};
+                hdrs[i].msg_hdr.msg_iov = &iovs[i];
+                hdrs[i].msg_hdr.msg_iovlen = 1;
+            }
+
+            for (std::size_t i = 0; i < hdrs.size(); ) {
+                const int n = ::sendmmsg(fd, hdrs.data() + i, static_cast<unsigned>(hdrs.size() - i), 0);
+                if (n < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    n_dropped.fetch_add(hdrs.size() - i, std::memory_order_relaxed);
+                    break;
+                }
+                i += n;
+            }
+
+            buf.clear();
+            msgs.clear();
+        }
+    public:
+        // Connects to the syslog socket at path.
+        SyslogSink(std::string_view app_name, const char *path = "/dev/log") : owned{true} {
+            sockaddr_un addr{};
+            addr.sun_family = AF_UNIX;
+            if (std::strlen(path) >= sizeof addr.sun_path)
+                throw std::system_error{ENAMETOOLONG, std::generic_category(), path};
+            std::strcpy(addr.sun_path, path);
+
+            fd = ::socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+            if (fd < 0)
+                throw std::system_error{errno, std::generic_category(), "socket()"};
+            if (::connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof addr) != 0) {
+                const int e = errno;
+                ::close(fd);
+                throw std::system_error{e, std::generic_category(), path};
+            }
+            init(app_name);
+        }
+
+        // Uses an already connected datagram socket, which is not owned.
+        SyslogSink(int fd, std::string_view app_name) : fd{fd} {
+            init(app_name);
+        }
+
+        SyslogSink(const SyslogSink &) = delete;
+        SyslogSink &operator=(const SyslogSink &) = delete;
+        ~SyslogSink() {
+            lines.drain([this](std::string_view line) { log(severity, line); });
+            flush();
+            if (owned)
+                ::close(fd);
+        }
+
+        // Queues one message.
+        void log(int sev, std::string_view msg) {
+            if (!msg.empty() && msg.back() == '\n')
+                msg.remove_suffix(1);
+
+            const std::lock_guard lock{mtx};
+            const auto start = buf.size();
+            const auto pri = facility * 8 + sev;
+            char prefix[8] = { '<' };
+            auto p = std::to_chars(prefix + 1, prefix + sizeof prefix - 3, pri).ptr;
+            *p++ = '>';
+            *p++ = '1';
+            *p++ = ' ';
+
+            // The timestamp's clock also ages the batch, a clock going backwards flushes it.
+            const auto now = std::chrono::system_clock::now();
+            if (msgs.empty())
+                oldest = now;
+
+            if (fork_generation() != generation)
+                render_header();
+
+            buf.append(prefix, p);
+            buf += timestamp(now);
+            buf += header_tail;
+            buf += msg;
+            msgs.emplace_back(start, buf.size() - start);
+
+            if (msgs.size() >= batch_size || now - oldest >= max_delay || now < oldest)
+                flush_locked();
+        }
+
+        void write(std::string_view s) {
+            lines.write(s, [this](std::string_view line) { log(severity, line); });
+        }
+
+        void flush() {
+            const std::lock_guard lock{mtx};
+            if (!msgs.empty())
+                flush_locked();
+        }
+
+        std::uint64_t dropped() const noexcept { return n_dropped.load(std::memory_order_relaxed); }
+    };
+
+    template<>
+    struct OutputAdapter<SyslogSink> {
+        inline static void write(SyslogSink *out, std::string_view s) {
+            out->write(s);
+        }
+    };
+}
+#endif // SAFMAT_OUT_SYSLOG
+
+#if SAFMAT_OUT_ZLIB
+namespace safmat::io {
+    // Compresses everything written to it into a gzip stream, which is written to another Output.
+    // Small writes are collected in the input buffer, the compressed data is only written in
+    // blocks of the output buffer's size. Not thread-safe.
+    class GzipWriter {
+    private:
+        Output out;
+        z_stream zs{};
+        std::unique_ptr<char[]> ibuf;
+        std::unique_ptr<char[]> obuf;
+        std::size_t isize;
+        std::size_t ilen{0};
+        std::size_t osize;
+        bool finished{false};
+
+        void deflate(const char *data, std::size_t n, int flush) {
+            zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+            zs.avail_in = static_cast<uInt>(n);
+            for (;;) {
+                const int r = ::deflate(&zs, flush);
+                if (r == Z_STREAM_ERROR)
+                    throw std::runtime_error{"deflate() failed."};
+                if (zs.avail_out != 0)
+                    break;
+                out.write({ obuf.get(), osize });
+                zs.next_out = reinterpret_cast<Bytef *>(obuf.get());
+                zs.avail_out = static_cast<uInt>(osize);
+            }
+
+            if (flush != Z_NO_FLUSH)
+                drain();
+        }
+
+        void drain() {
+            const auto n = osize - zs.avail_out;
+            if (n != 0)
+                out.write({ obuf.get(), n });
+            zs.next_out = reinterpret_cast<Bytef *>(obuf.get());
+            zs.avail_out = static_cast<uInt>(osize);
+        }
+
+        void deflate_input(int flush) {
+            deflate(ibuf.get(), ilen, flush);
+            ilen = 0;
+        }
+    public:
+        GzipWriter(const Output &out, int level = Z_DEFAULT_COMPRESSION, std::size_t isize = 256 * 1024, std::size_t osize = 1024 * 1024)
+            : out{out}, ibuf{new char[isize]}, obuf{new char[osize]}, isize{isize}, osize{osize}
+        {
+            // windowBits = 15 + 16: largest window with a gzip header and trailer.
+            if (deflateInit2(&zs, level, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+                throw std::runtime_error{"deflateInit2() failed."};
+            zs.next_out = reinterpret_cast<Bytef *>(obuf.get());
+            zs.avail_out = static_cast<uInt>(osize);
+        }
+
+        GzipWriter(const GzipWriter &) = delete;
+        GzipWriter &operator=(const GzipWriter &) = delete;
+        ~GzipWriter() {
+            try {
+                finish();
+            } catch (...) {}
+            deflateEnd(&zs);
+        }
+
+        void write(std::string_view s) {
+            if (ilen + s.size() <= isize) {
+                std::memcpy(ibuf.get() + ilen, s.data(), s.size());
+                ilen += s.size();
+                return;
+            }
+
+            deflate_input(Z_NO_FLUSH);
+            if (s.size() < isize) {
+                std::memcpy(ibuf.get(), s.data(), s.size());
+                ilen = s.size();
+            } else {
+                deflate(s.data(), s.size(), Z_NO_FLUSH);
+            }
+        }
+
+        // Compresses and writes everything written so far, so a reader can decompress it.
+        // Frequent calls hurt the compression ratio.
+        void flush() {
+            if (!finished)
+                deflate_input(Z_SYNC_FLUSH);
+        }
+
+        // Writes the gzip trailer; nothing may be written afterwards.
+        void finish() {
+            if (!finished) {
+                deflate_input(Z_FINISH);
+                finished = true;
+            }
+        }
+
+        std::size_t total_in() const noexcept { return zs.total_in + ilen; }
+        std::size_t total_out() const noexcept { return zs.total_out; }
+    };
+
+    template<>
+    struct OutputAdapter<GzipWriter> {
+        inline static void write(GzipWriter *out, std::string_view s) {
+            out->write(s);
+        }
+    };
+}
+#endif // SAFMAT_OUT_ZLIB
+
+#if SAFMAT_OUT_ROTATING
+namespace safmat::io {
+    // Appends lines to path and rotates it (path -> path.1 -> ... -> path.<keep>), before it grows beyond max_size.
+    // The formatting thread only copies lines into a buffer. A background thread writes the full buffers in order,
+    // preallocates the next file as path.next and retires the old one, so rotating only swaps the file descriptor.
+    // If the next file is not ready yet, the current one grows beyond max_size, instead of blocking.
+    // Writers only wait, while max_jobs buffers are queued. Write errors of the background thread
+    // are thrown by the next write() or flush().
+    class RotatingFile {
+    public:
+        static constexpr std::size_t buffer_size = 64 * 1024;
+        static constexpr std::size_t max_jobs = 16;
+    private:
+        struct Job {
+            enum Kind { write, retire, close } kind;
+            int fd;
+            std::size_t size;           // for retire and close: the final size of the file
+            std::string data;
+        };
+
+        std::string path;
+        std::size_t max_size;
+        unsigned keep;
+        internal::LineStaging lines{};
+
+        std::mutex mtx{};
+        std::condition_variable cv{};
+        std::condition_variable done{};
+        int fd{-1};
+        std::size_t size{0};
+        std::string pending{};
+        int next_fd{-1};
+        std::vector<Job> jobs{};
+        std::vector<std::string> spare{};
+        std::uint64_t n_queued{0};
+        std::uint64_t n_done{0};
+        int error{0};
+        std::size_t n_rotations{0};
+        bool stop{false};
+        std::thread worker{};
+
+        static void write_all(int fd, std::string_view s) {
+            while (!s.empty()) {
+                const auto n = ::write(fd, s.data(), s.size());
+                if (n < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    throw std::system_error{errno, std::generic_category(), "write()"};
+                }
+                s.remove_prefix(n);
+            }
+        }
+
+        void check_error() {
+            if (error != 0)
+                throw std::system_error{std::exchange(error, 0), std::generic_category(), "write()"};
+        }
+
+        // Hands pending to the background thread. Must be called with mtx held.
+        void enqueue(Job::Kind kind) {
+            std::string buf{};
+            if (!spare.empty()) {
+                buf = std::move(spare.back());
+                spare.pop_back();
+            } else if (kind != Job::close) {
+                buf.reserve(buffer_size);
+            }
+
+            jobs.push_back({ kind, fd, size, std::exchange(pending, std::move(buf)) });
+            ++n_queued;
+            cv.notify_one();
+        }
+
+        void commit(std::string_view line) {
+            std::unique_lock lock{mtx};
+            check_error();
+            if (size + line.size() > max_size && size != 0 && next_fd >= 0) {
+                enqueue(Job::retire);
+                fd = std::exchange(next_fd, -1);
+                size = 0;
+                ++n_rotations;
+            }
+
+            pending += line;
+            size += line.size();
+            if (pending.size() >= buffer_size) {
+                done.wait(lock, [this] { return n_queued - n_done < max_jobs; });
+                enqueue(Job::write);
+            }
+        }
+
+        // Writes a buffer and, if the file is retired, releases the preallocated space and shifts the names.
+        void process(Job &j) {
+            try {
+                write_all(j.fd, j.data);
+            } catch (const std::system_error &e) {
+                const std::lock_guard lock{mtx};
+                error = e.code().value();
+            }
+            if (j.kind == Job::write)
+                return;
+
+            (void)::ftruncate(j.fd, static_cast<off_t>(j.size));
+            ::close(j.fd);
+            if (j.kind == Job::close)
+                return;
+
+            for (unsigned i = keep; i > 1; --i)
+                std::rename(format("{}.{}", path, i - 1).c_str(), format("{}.{}", path, i).c_str());
+            if (keep != 0) {
+                std::rename(path.c_str(), format("{}.1", path).c_str());
+            } else {
+                std::remove(path.c_str());
+            }
+            std::rename(format("{}.next", path).c_str(), path.c_str());
+        }
+
+        int prepare() {
+            const int nfd = ::open(format("{}.next", path).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#ifdef FALLOC_FL_KEEP_SIZE
+            if (nfd >= 0)
+                (void)::fallocate(nfd, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(max_size));
+#endif
+            return nfd;
+        }
+
+        void run() {
+            std::unique_lock lock{mtx};
+            for (;;) {
+                cv.wait(lock, [this] { return stop || !jobs.empty() || next_fd < 0; });
+
+                if (!jobs.empty()) {
+                    auto js = std::move(jobs);
+                    jobs.clear();
+                    lock.unlock();
+                    for (auto &j : js)
+                        process(j);
+                    lock.lock();
+
+                    // Keep a few buffers, so that the formatting thread doesn't allocate new ones.
+                    for (auto &j : js) {
+                        if (j.kind == Job::write && spare.size() < 2) {
+                            j.data.clear();
+                            spare.push_back(std::move(j.data));
+                        }
+                    }
+                    n_done += js.size();
+                    done.notify_all();
+                    continue;
+                }
+
+                if (stop)
+                    break;
+
+                if (next_fd < 0) {
+                    lock.unlock();
+                    const int nfd = prepare();
+                    lock.lock();
+                    if (nfd < 0) {
+                        cv.wait_for(lock, std::chrono::seconds{1}, [this] { return stop || !jobs.empty(); });
+                        continue;
+                    }
+                    next_fd = nfd;
+                }
+            }
+        }
+    public:
+        RotatingFile(std::string path, std::size_t max_size, unsigned keep = 5)
+            : path{std::move(path)}, max_size{max_size}, keep{keep}
+        {
+            fd = ::open(this->path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (fd < 0)
+                throw std::system_error{errno, std::generic_category(), this->path};
+
+            struct stat st;
+            if (::fstat(fd, &st) == 0)
+                size = st.st_size;
+            pending.reserve(buffer_size);
+            worker = std::thread{[this] { run(); }};
+        }
+
+        RotatingFile(const RotatingFile &) = delete;
+        RotatingFile &operator=(const RotatingFile &) = delete;
+        ~RotatingFile() {
+            try {
+                lines.drain([this](std::string_view line) { commit(line); });
+            } catch (const std::system_error &) {}
+            {
+                const std::lock_guard lock{mtx};
+                enqueue(Job::close);
+                stop = true;
+            }
+            worker.join();
+
+            if (next_fd >= 0) {
+                ::close(next_fd);
+                std::remove(format("{}.next", path).c_str());
+            }
+        }
+
+        void write(std::string_view s) {
+            lines.write(s, [this](std::string_view line) { commit(line); });
+        }
+
+        // Writes the buffered lines to the current file and waits until they have been written.
+        void flush() {
+            std::unique_lock lock{mtx};
+            if (!pending.empty())
+                enqueue(Job::write);
+            const auto target = n_queued;
+            done.wait(lock, [&] { return n_done >= target; });
+            check_error();
+        }
+
+        std::size_t rotations() noexcept {
+            const std::lock_guard lock{mtx};
+            return n_rotations;
+        }
+    };
+
+    template<>
+    struct OutputAdapter<RotatingFile> {
+        inline static void write(RotatingFile *out, std::string_view s) {
+            out->write(s);
+        }
+    };
+}
+#endif // SAFMAT_OUT_ROTATING
+
+#if SAFMAT_OUT_TEE
+namespace safmat::io {
+    // Writes the same lines to several outputs, each with a minimum level.
+    // Lines printed through print()/println() with a level are formatted once and only passed to the outputs,
+    // whose minimum level is at most that level. Anything written through the Output goes to all outputs.
+    // Outputs must not be added, while the Tee is written to.
+    class Tee {
+    public:
+        struct Sink {
+            Output out;
+            int min_level{0};
+        };
+    private:
+        std::vector<Sink> sinks{};
+        mutable internal::LineStaging lines{};
+
+        // Per-thread buffer for print()/println(), one per nesting level,
+        // so an output, that prints to a Tee again while a line is dispatched, gets its own.
+        class Staging {
+        private:
+            static std::vector<std::unique_ptr<std::string>> &pool() {
+                thread_local std::vector<std::unique_ptr<std::string>> bufs{};
+                return bufs;
+            }
+            static inline thread_local std::size_t depth{0};
+        public:
+            std::string &buf;
+
+            Staging() : buf{ [] () -> std::string & {
+                auto &bufs = pool();
+                if (depth == bufs.size())
+                    bufs.push_back(std::make_unique<std::string>());
+                auto &b = *bufs[depth++];
+                b.clear();
+                return b;
+            }() } {}
+            Staging(const Staging &) = delete;
+            Staging &operator=(const Staging &) = delete;
+            ~Staging() { --depth; }
+        };
+    public:
+        Tee() = default;
+        Tee(std::initializer_list<Sink> sinks) : sinks{sinks} {}
+
+        Tee(const Tee &) = delete;
+        Tee &operator=(const Tee &) = delete;
+        ~Tee() {
+            lines.drain([this](std::string_view line) { dispatch(std::numeric_limits<int>::max(), line); });
+        }
+
+        void add(const Output &out, int min_level = 0) {
+            sinks.push_back({ out, min_level });
+        }
+
+        // Writes s to all outputs, that accept level.
+        void dispatch(int level, std::string_view s) const {
+            for (const auto &sink : sinks) {
+                if (level >= sink.min_level)
+                    sink.out.write(s);
+            }
+        }
+
+        void write(std::string_view s) const {
+            lines.write(s, [this](std::string_view line) {
+                dispatch(std::numeric_limits<int>::max(), line);
+            });
+        }
+
+        template<class... Args>
+        void print(int level, std::string_view fmt, Args&&... args) const {
+            const Staging staging{};
+            basic_format_to(staging.buf, fmt, {}, std::forward<Args>(args)...);
+            dispatch(level, staging.buf);
+        }
+
+        template<class... Args>
+        void println(int level, std::string_view fmt, Args&&... args) const {
+            const Staging staging{};
+            basic_format_to(staging.buf, fmt, "\n", std::forward<Args>(args)...);
+            dispatch(level, staging.buf);
+        }
+    };
+
+    template<>
+    struct OutputAdapter<Tee> {
+        inline static void write(Tee *out, std::string_view s) {
+            out->write(s);
+        }
+    };
+}
+#endif // SAFMAT_OUT_TEE
+
+#if SAFMAT_OUT_PREFIX
+namespace safmat::io {
+    // Starts every line with a prefix, that is rendered from a pattern with the following fields:
+    // - {time}: the current UTC time (eg. "2026-10-18T12:34:56.123456Z"), only re-rendered when the second changes
+    // - {thread}: the thread id, rendered once per thread
+    // - {component}: the current thread's component, see set_component()
+    // Use "{{" and "}}" for literal braces.
+    class PrefixFilter {
+    private:
+        enum class Field { text, time, thread, component };
+        struct Segment {
+            Field field;
+            std::string text{};
+        };
+
+        Output out;
+        std::vector<Segment> segments{};
+        internal::LineStaging lines{};
+
+        static std::string &component() {
+            thread_local std::string name{};
+            return name;
+        }
+
+        static const std::string &thread_id() {
+#if SAFMAT_POSIX && defined(__linux__)
+            thread_local const std::string id = format("{}", ::gettid());
+#else
+            static std::atomic<unsigned> next{1};
+            thread_local const std::string id = format("{}", next++);
+#endif
+            return id;
+        }
+
+        void render(std::string &buf) const {
+            thread_local internal::TimestampCache timestamp{};
+            for (const auto &seg : segments) {
+                switch (seg.field) {
+                case Field::text:
+                    buf += seg.text;
+                    break;
+                case Field::time:
+                    buf += timestamp(std::chrono::system_clock::now());
+                    break;
+                case Field::thread:
+                    buf += thread_id();
+                    break;
+                case Field::component:
+                    buf += component();
+                    break;
+                }
+            }
+        }
+    public:
+        PrefixFilter(const Output &out, std::string_view pattern = "{time} [{thread}] {component}: ") : out{out} {
+            std::string text{};
+            while (!pattern.empty()) {
+                const auto c = pattern.front();
+                if ((c == '{' || c == '}') && pattern.size() > 1 && pattern[1] == c) {
+                    text += c;
+                    pattern.remove_prefix(2);
+                    continue;
+                }
+                if (c == '}')
+                    throw format_error("'}' must be escaped with '}'.");
+                if (c != '{') {
+                    text += c;
+                    pattern.remove_prefix(1);
+                    continue;
+                }
+
+                const auto end = pattern.find('}');
+                if (end == std::string_view::npos)
+                    throw format_error("Expected '}'.");
+                const auto name = pattern.substr(1, end - 1);
+                Field field;
+                if (name == "time") {
+                    field = Field::time;
+                } else if (name == "thread") {
+                    field = Field::thread;
+                } else if (name == "component") {
+                    field = Field::component;
+                } else {
+                    throw format_error{"Unknown prefix field."};
+                }
+
+                if (!text.empty())
+                    segments.push_back({ Field::text, std::move(text) });
+                text.clear();
+                segments.push_back({ field });
+                pattern.remove_prefix(end + 1);
+            }
+            if (!text.empty())
+                segments.push_back({ Field::text, std::move(text) });
+        }
+
+        PrefixFilter(const PrefixFilter &) = delete;
+        PrefixFilter &operator=(const PrefixFilter &) = delete;
+        ~PrefixFilter() {
+            lines.drain([this](std::string_view line) { out.write(line); });
+        }
+
+        // Sets the {component} of the current thread.
+        static void set_component(std::string_view name) {
+            component() = name;
+        }
+
+        // Every line is passed to the output with a single write.
+        void write(std::string_view s) {
+            auto &buf = lines.buffer();
+            while (!s.empty()) {
+                if (buf.empty())
+                    render(buf);
+
+                const auto nl = s.find('\n');
+                if (nl == std::string_view::npos) {
+                    buf += s;
+                    return;
+                }
+
+                buf += s.substr(0, nl + 1);
+                out.write(buf);
+                buf.clear();
+                s.remove_prefix(nl + 1);
+            }
+        }
+    };
+
+    template<>
+    struct OutputAdapter<PrefixFilter> {
+        inline static void write(PrefixFilter *out, std::string_view s) {
+            out->write(s);
+        }
+    };
+}
+#endif // SAFMAT_OUT_PREFIX
+
+// Text styles, eg. styled(x, fg::red | bold).
+namespace safmat {
+    // A combination of SGR codes. The escape sequence is rendered at construction (at compile time for constants),
+    // so emitting a style is just a copy.
+    class Style {
+    private:
+        std::array<unsigned char, 8> codes{};
+        std::size_t ncodes{0};
+        std::array<char, 40> seq{};
+        std::size_t nseq{0};
+
+        constexpr void render() noexcept {
+            nseq = 0;
+            seq[nseq++] = '\x1b';
+            seq[nseq++] = '[';
+            for (std::size_t i = 0; i < ncodes; ++i) {
+                if (i != 0)
+                    seq[nseq++] = ';';
+                const auto c = codes[i];
+                if (c >= 100)
+                    seq[nseq++] = static_cast<char>('0' + c / 100);
+                if (c >= 10)
+                    seq[nseq++] = static_cast<char>('0' + c / 10 % 10);
+                seq[nseq++] = static_cast<char>('0' + c % 10);
+            }
+            seq[nseq++] = 'm';
+        }
+    public:
+        constexpr Style() noexcept = default;
+        constexpr explicit Style(unsigned char code) noexcept : codes{code}, ncodes{1} { render(); }
+
+        // Later codes override earlier ones (eg. fg::red | fg::blue is blue).
+        friend constexpr Style operator|(Style a, const Style &b) noexcept {
+            for (std::size_t i = 0; i < b.ncodes && a.ncodes < a.codes.size(); ++i)
+                a.codes[a.ncodes++] = b.codes[i];
+            a.render();
+            return a;
+        }
+
+        constexpr bool empty() const noexcept { return ncodes == 0; }
+        constexpr std::string_view sgr() const noexcept { return { seq.data(), nseq }; }
+
+        static constexpr std::string_view reset{"\x1b[0m"};
+    };
+
+    namespace style {
+        inline constexpr Style bold{1};
+        inline constexpr Style dim{2};
+        inline constexpr Style italic{3};
+        inline constexpr Style underline{4};
+        inline constexpr Style blink{5};
+        inline constexpr Style reverse{7};
+        inline constexpr Style strike{9};
+
+        namespace fg {
+            inline constexpr Style black{30}, red{31}, green{32}, yellow{33}, blue{34}, magenta{35}, cyan{36}, white{37};
+            inline constexpr Style bright_black{90}, bright_red{91}, bright_green{92}, bright_yellow{93};
+            inline constexpr Style bright_blue{94}, bright_magenta{95}, bright_cyan{96}, bright_white{97};
+        }
+
+        namespace bg {
+            inline constexpr Style black{40}, red{41}, green{42}, yellow{43}, blue{44}, magenta{45}, cyan{46}, white{47};
+            inline constexpr Style bright_black{100}, bright_red{101}, bright_green{102}, bright_yellow{103};
+            inline constexpr Style bright_blue{104}, bright_magenta{105}, bright_cyan{106}, bright_white{107};
+        }
+    }
+
+    // When styles are emitted: automatic only does so for terminals (see Output::is_tty()),
+    // which never includes std::ostream outputs.
+    enum class StyleMode { automatic, always, never };
+    // Atomic, because it may be changed, while other threads are formatting.
+    inline std::atomic<StyleMode> style_mode{StyleMode::automatic};
+
+    template<class T>
+    struct Styled {
+        const T &value;
+        Style style;
+    };
+
+    template<class T>
+    Styled<T> styled(const T &value, const Style &style) noexcept {
+        return { value, style };
+    }
+
+    // The spec is the one of T.
+    template<Formattable T>
+    struct Formatter<Styled<T>> : Formatter<T> {
+        void format_to(FormatContext &ctx, const Styled<T> &x) {
+            const auto mode = style_mode.load(std::memory_order_relaxed);
+            const bool enabled = !x.style.empty() && (mode == StyleMode::always
+                || (mode == StyleMode::automatic && ctx.out.is_tty()));
+            if (enabled)
+                ctx.out.write(x.style.sgr());
+            Formatter<T>::format_to(ctx, x.value);
+            if (enabled)
+                ctx.out.write(Style::reset);
+        }
+    };
 }
 
 #endif // FILE_SAFMAT_HPP
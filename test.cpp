@@ -1,9 +1,25 @@
 #define SAFMAT_OUT_OSTREAM 1
+#define SAFMAT_BINLOG 1
+#define SAFMAT_OUT_MMAP 1
+#define SAFMAT_OUT_SHM 1
+#define SAFMAT_OUT_SYSLOG 1
+#define SAFMAT_OUT_ROTATING 1
+#define SAFMAT_OUT_PREFIX 1
+#define SAFMAT_OUT_TEE 1
+#include <stdexcept>
 #include <iostream>
+#include <sstream>
 #include <numbers>
 #include <vector>
 #include <set>
+#include <map>
 #include "safmat.hpp"
+#if SAFMAT_POSIX
+# include <sys/resource.h>
+# include <sys/wait.h>
+# include <fcntl.h>
+# include <poll.h>
+#endif
 
 
 struct RandomStruct {
@@ -20,13 +36,120 @@ struct safmat::Formatter<RandomStruct> {
     }
 };
 
+// Counts, how many values have been formatted.
+struct Tally {
+    static inline std::size_t formatted{0};
+};
+
+template<>
+struct safmat::Formatter<Tally> {
+    void parse(safmat::InputIterator &) {}
+    void format_to(safmat::FormatContext &ctx, const Tally &) {
+        ++Tally::formatted;
+        ctx.out.write("tally ");
+    }
+};
+
+#if SAFMAT_OUT_TEE
+// Prints another line to the Tee, when it receives its first one.
+struct Echo {
+    const safmat::io::Tee *tee{nullptr};
+    std::string lines{};
+};
+
 template<>
-struct safmat::io::OutputAdapter<std::vector<char>> {
-    inline static void write(std::vector<char> *vec, std::string_view s) {
-        vec->insert(end(*vec), begin(s), end(s));
+struct safmat::io::OutputAdapter<Echo> {
+    inline static void write(Echo *e, std::string_view s) {
+        const bool first = e->lines.empty();
+        e->lines += s;
+        if (first)
+            e->tee->println(0, "echo of '{}'", s.substr(0, s.size() - 1));
+    }
+};
+#endif
+
+enum class Color { Red, Green, Blue = 10 };
+
+enum class Flags : unsigned { Read = 1 << 0, Write = 1 << 8, Exec = 1 << 16 };
+
+template<>
+struct safmat::EnumNames<Flags> {
+    static constexpr std::array<std::pair<Flags, std::string_view>, 3> names{{
+        { Flags::Read, "Read" }, { Flags::Write, "Write" }, { Flags::Exec, "Exec" },
+    }};
+};
+
+// Counts, how often the stream is flushed.
+struct SyncCounter : std::stringbuf {
+    int syncs{0};
+
+    int sync() override {
+        ++syncs;
+        return std::stringbuf::sync();
+    }
+};
+
+#if SAFMAT_ASYNC && SAFMAT_POSIX
+// Non-blocking pipe, driven by the poll() loop in run_async().
+struct PipeSink {
+    int fd;
+    std::coroutine_handle<> waiting{};
+
+    std::size_t try_write(std::string_view s) {
+        const auto n = ::write(fd, s.data(), s.size());
+        return n < 0 ? 0 : n;
+    }
+
+    auto writable() {
+        struct Awaiter {
+            PipeSink &sink;
+
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> h) noexcept { sink.waiting = h; }
+            void await_resume() const noexcept {}
+        };
+        return Awaiter{ *this };
     }
 };
 
+// Prints a big container into a pipe, while reading the other end in the same thread.
+static std::string run_async(const std::vector<int> &data) {
+    int fds[2];
+    if (::pipe2(fds, O_NONBLOCK) != 0)
+        throw std::runtime_error{"pipe2() failed"};
+
+    PipeSink sink{ fds[1] };
+    std::string received{};
+    std::size_t waits{0};
+
+    auto task = safmat::async_println(sink, "data = {}", data);
+    task.start();
+
+    while (true) {
+        pollfd pfds[2]{ { fds[0], POLLIN, 0 }, { fds[1], POLLOUT, 0 } };
+        ::poll(pfds, sink.waiting ? 2 : 1, task.done() ? 0 : -1);
+
+        char buf[4096];
+        ssize_t n;
+        while ((n = ::read(fds[0], buf, sizeof buf)) > 0)
+            received.append(buf, n);
+
+        if (sink.waiting && (pfds[1].revents & POLLOUT)) {
+            ++waits;
+            std::exchange(sink.waiting, {}).resume();
+        } else if (task.done() && n <= 0) {
+            break;
+        }
+    }
+
+    task.result();
+    ::close(fds[0]);
+    ::close(fds[1]);
+    safmat::println("async = {} bytes after {} waits", received.size(), waits);
+    return received;
+}
+#endif
+
 int main() {
     using namespace std::literals;
     using namespace safmat;
@@ -47,6 +170,17 @@ int main() {
 
         println("{} {0:d} {}", true, 'X');
 
+        {
+            // A FormatArg owns its value, so it can outlive the expression, that created it.
+            std::vector<FormatArg> args{};
+            args.emplace_back(std::string{"owned"});
+            args.emplace_back(42);
+            std::string s{};
+            FormatContext ctx{ s, args };
+            xformat_to(ctx, "{} {}");
+            println("format args = {}", s);
+        }
+
         println("'{:^11.5}'", "Hello World");
 
         println("{:-^40}", std::pair{42, "Hello"});
@@ -54,9 +188,439 @@ int main() {
         RandomStruct r{ 42, "Hello World", { 1, 2, 5, 4, 96, 69, -420, 22 } };
         println(std::cout, "r = {}", r);
 
+        {
+            // unitbuf is honored, whether the stream is written directly or through an Output.
+            SyncCounter buf{};
+            std::ostream os{&buf};
+            os << std::unitbuf;
+            println(os, "direct {}", 1);
+            const auto direct = std::exchange(buf.syncs, 0);
+            const io::Output erased{os};
+            println(erased, "erased {}", 2);
+            println("unitbuf = {} / {}, content = {}", direct > 0, buf.syncs > 0, buf.str() == "direct 1\nerased 2\n");
+        }
+
+        println("colors = {} {} {:>6} {:d} {}", Color::Red, Color::Green, Color::Blue, Color::Blue, static_cast<Color>(3));
+        println("flags = {} {} {:x}", Flags::Write, Flags::Exec, static_cast<Flags>(3));
+
+        println("radix = {:r36} {:r62} {:R16} {:>8r2}", 1295, 123456789ull, -255, 5);
+
+#ifdef __SIZEOF_INT128__
+        const auto u128 = ~static_cast<unsigned __int128>(0);
+        println("int128 = {} {} {:#x} {:>+12}", u128, -static_cast<__int128>(u128 >> 1) - 1, u128 >> 64, static_cast<__int128>(42));
+#endif
+
+        std::optional<int> opt{42};
+        std::variant<int, std::string, double> var{"Hello"};
+        println("opt = {:#x} {}", opt, std::optional<int>{});
+        println("var = '{:>7}' '{:>7}'", var, std::variant<int, std::string, double>{3.5});
+        println("padded = '{:>6}' '{:>6}' '{:*^8}'", std::optional<int>{5}, std::optional<int>{}, std::optional<std::string>{});
+#if __cpp_lib_expected >= 202202L
+        println("expected = '{:>6}' '{:<16}'", std::expected<int, std::string>{7}, std::expected<int, std::string>{std::unexpect, "bad"});
+#endif
+
+        std::vector<std::vector<double>> mat{ { 1.0, 2.5 }, { -3.25, 4.125 } };
+        println("mat = {:::.3f} {::{:n:>6.1f}}", mat, mat);
+        println("{::.3f}", matrix(mat));
+        println("nested args = {::{}.{}f} {:p:{}.{}f} fill = {::>4}", std::vector{ 1.5, 2.25 }, 6, 2, matrix(mat), 5, 1, std::vector{ 1, 2 });
+
+        const auto ints = std::vector{ 1, -20, 300, 4000, 5, 60 };
+        println("{:p:#x}", matrix(ints, 3, 2));
+
+        {
+            // The parallel output must be the same as the serial one, with any number of threads.
+            std::vector<long> cells(1000 * 3);
+            for (std::size_t i = 0; i < cells.size(); ++i)
+                cells[i] = static_cast<long>(i * i % 100003) - 50000;
+            const std::vector<long> head(cells.begin(), cells.begin() + 512 * 3);
+            const auto big = matrix(cells, 1000, 3), small = matrix(head, 512, 3);
+            const auto serial = format("{::#x}", big);
+            println("parallel = {} {} {}", format("{:p2:#x}", small) == format("{::#x}", small),
+                    format("{:p3:#x}", big) == serial, format("{:p8:#x}", big) == serial);
+        }
+
+        std::map<std::string, int> map{ { "one", 1 }, { "two", 2 }, { "forty-two", 42 } };
+        println("map = {} {:n:{:>9}{:#x}}", map, map);
+
         std::vector<char> chars{};
         print(chars, "Hello World in the vector of chars.");
         println("{}", chars);
+
+        io::ChunkedBuffer chunks{};
+        for (int i = 0; i < 10'000; ++i)
+            println(chunks, "line {:>5}", i);
+        println("chunks = {} bytes in {} blocks", chunks.size(), std::distance(chunks.begin(), chunks.end()));
+        chunks.clear();
+        {
+            // A moved-from buffer must not write into the blocks it gave away.
+            io::ChunkedBuffer moved{};
+            moved.write("hello");
+            chunks = std::move(moved);
+            moved.write("OOPS");
+            moved.clear();
+            println("moved = '{}' {} / '{}' {}", chunks.str(), chunks.size(), moved.str(), moved.size());
+            chunks.clear();
+        }
+        println(chunks, "Hello from a ChunkedBuffer.");
+#if SAFMAT_POSIX
+        std::fflush(stdout);
+        chunks.write_to(STDOUT_FILENO);
+#endif
+
+        // Format into a tiny buffer, pausing whenever it is full.
+        ResumableFormat rf{"{} -> {::x} ({})\n", "resumable", vec, std::string{"done"}};
+        std::string resumed{};
+        for (std::array<char, 7> buf{}; !rf.done(); )
+            resumed.append(buf.data(), rf.read(buf));
+        print("{}", resumed);
+
+        std::vector<int> big(100'000);
+        for (std::size_t i = 0; i < big.size(); ++i)
+            big[i] = static_cast<int>(i);
+
+        std::size_t nchunks{0};
+        std::string pulled{};
+        for (auto chunk : format_chunks("<{}>{}</{}>", "body", big, "body")) {
+            pulled += chunk;
+            ++nchunks;
+        }
+        println("chunks ok = {} ({} chunks)", pulled == format("<{}>{}</{}>", "body", big, "body"), nchunks);
+
+        {
+            // A container field is formatted a few elements at a time, not buffered as a whole.
+            auto lazy = format_chunks("{}", std::vector<Tally>(100'000));
+            auto it = lazy.begin();
+            const auto first = (*it).size();
+            println("lazy container = {} elements formatted for the first chunk of {} bytes, {}",
+                    Tally::formatted < 100'000 ? "some" : "all", first, Tally::formatted * 8 < 2 * io::ChunkedBuffer::block_size);
+        }
+        {
+            // Adjacent fields (and an empty one in between) must not overwrite the chunk, that was just handed out.
+            std::string adjacent{};
+            for (auto chunk : format_chunks("{}{}{}{}", std::string(10, 'A'), std::string(10, 'B'), "", std::string(10, 'C')))
+                adjacent += chunk;
+            println("adjacent chunks = {}", adjacent);
+        }
+#if SAFMAT_ASYNC && SAFMAT_POSIX
+        println("async ok = {}", run_async(big) == format("data = {}\n", big));
+#endif
+
+        FILE *blog = std::tmpfile();
+        binlog::Writer writer{blog};
+        for (int i = 0; i < 3; ++i)
+            writer.log("binlog: [{:>3}] {} {:.2f} {} {:x} {}", i, "request", 0.5 * i, i % 2 == 0, -42, vec);
+        // 128-bit integers keep all their bits, whether std::integral<> includes them (-std=gnu++20) or not.
+        writer.log("binlog: {} {}", ~static_cast<unsigned __int128>(0), -static_cast<__int128>(~static_cast<unsigned __int128>(0) >> 1) - 1);
+        // Non-primitive arguments are stored pre-rendered, so only a string's spec can be applied when decoding.
+        writer.log("binlog: {:>6} {:*^26}", Color::Green, vec);
+        try {
+            writer.log("binlog: {::x}", vec);
+        } catch (const format_error &e) {
+            println("binlog rejected '{{::x}}': {}", e.what());
+        }
+        try {
+            writer.log("binlog: {:s}", 2);
+        } catch (const format_error &e) {
+            println("binlog rejected '{{:s}}': {}", e.what());
+        }
+        writer.flush();
+        std::rewind(blog);
+        binlog::Reader reader{blog};
+        while (reader.next(stdout));
+        std::fclose(blog);
+
+        {
+            // A record, that can't be rendered (here: a format string corrupted after writing), is skipped.
+            FILE *file = std::tmpfile();
+            {
+                binlog::Writer w{file};
+                w.log("first {}", 1);
+                w.log("bad {:d}", 2);
+                w.log("third {}", 3);
+                w.flush();
+            }
+            std::string data(4096, '\0');
+            std::rewind(file);
+            data.resize(std::fread(data.data(), 1, data.size(), file));
+            data.replace(data.find("{:d}"), 4, "{:s}");
+            std::rewind(file);
+            std::fwrite(data.data(), 1, data.size(), file);
+            std::rewind(file);
+
+            binlog::Reader r{file};
+            std::string text{}, errors{};
+            while (true) {
+                try {
+                    if (!r.next(text))
+                        break;
+                } catch (const binlog::record_error &e) {
+                    errors += e.what();
+                }
+            }
+            std::fclose(file);
+            println("binlog skipped = {}, {}", text == "first 1\nthird 3\n", !errors.empty());
+        }
+
+        {
+            const char *path = "/tmp/safmat-test.ring";
+            {
+                io::MmapRing ring{path, 64};
+                for (int i = 0; i < 10; ++i)
+                    println(ring, "ring line {}", i);
+            }
+            print("{}", io::MmapRing::recover(path));
+            std::remove(path);
+
+            try {
+                io::MmapRing empty{path, 0};
+            } catch (const std::system_error &e) {
+                println("zero capacity = {}", e.code() == std::errc::invalid_argument);
+            }
+        }
+
+#if SAFMAT_POSIX
+        {
+            // Two forked workers write into the ring, this process collects.
+            io::ShmRing ring{std::size_t{1} << 16};
+            for (int id = 0; id < 2; ++id) {
+                if (::fork() == 0) {
+                    for (int i = 0; i < 100; ++i)
+                        println(ring, "worker {} line {}", id, i);
+                    std::_Exit(0);
+                }
+            }
+            while (::wait(nullptr) > 0);
+
+            std::string lines{};
+            ring.read(lines);
+            println("shm = {} lines, {} dropped", std::ranges::count(lines, '\n'), ring.dropped());
+        }
+
+        {
+            // A worker, that crashes while copying its line, must not stall the collector.
+            io::ShmRing ring{std::size_t{1} << 12};
+            ring.stall_timeout = {};
+            void *unreadable = ::mmap(nullptr, 4096, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (::fork() == 0) {
+                const rlimit no_core{ 0, 0 };
+                ::setrlimit(RLIMIT_CORE, &no_core);
+                ring.write_line({ static_cast<const char *>(unreadable), 16 });
+                std::_Exit(0);
+            }
+            ::wait(nullptr);
+            ::munmap(unreadable, 4096);
+
+            println(ring, "after the crash");
+            std::string lines{};
+            ring.read(lines);
+            println("shm crash = '{}', {} dropped", lines.substr(0, lines.size() - 1), ring.dropped());
+        }
+
+        {
+            // The other end of the socket pair plays the syslog daemon.
+            int sv[2];
+            ::socketpair(AF_UNIX, SOCK_DGRAM, 0, sv);
+            {
+                io::SyslogSink syslog{sv[0], "safmat-test"};
+                syslog.batch_size = 4;
+                for (int i = 0; i < 6; ++i)
+                    println(syslog, "syslog message {}", i);
+            }
+
+            char msg[512];
+            std::size_t nmsgs{0};
+            bool framed{true};
+            ssize_t n;
+            while ((n = ::recv(sv[1], msg, sizeof msg, MSG_DONTWAIT)) > 0) {
+                const std::string_view m{msg, static_cast<std::size_t>(n)};
+                framed = framed && m.starts_with("<14>1 ") && m[10] == '-' && m[32] == 'Z'
+                    && m.ends_with(format(" safmat-test {} - - syslog message {}", ::getpid(), nmsgs));
+                ++nmsgs;
+            }
+            println("syslog = {} messages, framed = {}", nmsgs, framed);
+
+            // A forked child logs with its own PROCID.
+            {
+                io::SyslogSink syslog{sv[0], "safmat-test"};
+                println(syslog, "parent");
+                syslog.flush();
+                const pid_t child = ::fork();
+                if (child == 0) {
+                    println(syslog, "child");
+                    syslog.flush();
+                    ::_exit(0);
+                }
+                ::waitpid(child, nullptr, 0);
+
+                std::string procids{};
+                while ((n = ::recv(sv[1], msg, sizeof msg, MSG_DONTWAIT)) > 0) {
+                    const std::string_view m{msg, static_cast<std::size_t>(n)};
+                    procids += m.ends_with(format(" {} - - parent", ::getpid())) ? "parent "
+                        : m.ends_with(format(" {} - - child", child)) ? "child " : "wrong ";
+                }
+                println("syslog procid = {}", procids);
+            }
+
+            // With no delay allowed, every message is sent right away, despite the batch size.
+            {
+                io::SyslogSink syslog{sv[0], "safmat-test"};
+                syslog.max_delay = std::chrono::milliseconds{0};
+                println(syslog, "immediate");
+                nmsgs = 0;
+                while (::recv(sv[1], msg, sizeof msg, MSG_DONTWAIT) > 0)
+                    ++nmsgs;
+                println("syslog delay = {} sent, {} dropped", nmsgs, syslog.dropped());
+            }
+            ::close(sv[0]);
+            ::close(sv[1]);
+        }
+#endif
+
+        {
+            const std::string path = format("/tmp/safmat-test-{}.log", ::getpid());
+            std::size_t written{0}, rotations{0};
+            {
+                io::RotatingFile log{path, 4096, 2};
+                // Write until the log has been rotated more often, than files are kept.
+                for (int i = 0; log.rotations() < 3 && i < 1000000; ++i) {
+                    println(log, "rotating line {:>7}", i);
+                    written += 22;
+                    // Give the background thread a chance to prepare the next file.
+                    if (i % 100 == 0)
+                        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+                }
+                log.flush();
+                rotations = log.rotations();
+            }
+
+            // Exactly the newest files are kept, every file ends at a line boundary and no next file is left behind.
+            std::size_t kept{0}, files{0};
+            bool lines{true};
+            for (auto p : { path, path + ".1", path + ".2", path + ".3" }) {
+                FILE *file = std::fopen(p.c_str(), "r");
+                if (!file)
+                    continue;
+                std::string data(64 * 1024, '\0');
+                data.resize(std::fread(data.data(), 1, data.size(), file));
+                std::fclose(file);
+                std::remove(p.c_str());
+                kept += data.size();
+                files += p != path;
+                lines = lines && data.size() % 22 == 0 && data.ends_with('\n');
+            }
+            FILE *next = std::fopen((path + ".next").c_str(), "r");
+            if (next)
+                std::fclose(next);
+            println("rotating = {} rotations, {} rotated files, kept {} bytes, lines = {}, next = {}",
+                    rotations >= 3 ? "some" : "too few", files, kept < written ? "some" : "all", lines, next != nullptr);
+        }
+
+#if SAFMAT_OUT_TEE
+        {
+            std::string all{}, errors{};
+            std::vector<char> copy{};
+            io::Tee tee{ { all }, { errors, 3 } };
+            tee.add(copy);
+            tee.println(1, "tee {}", "debug");
+            tee.println(3, "tee {}", "error");
+            println(tee, "tee {}", "unleveled");
+            println("tee = {} / {} / {} lines", std::ranges::count(all, '\n'), std::ranges::count(errors, '\n'), std::ranges::count(copy, '\n'));
+        }
+
+        {
+            // A sink at the address of a destroyed one must not inherit its partial line,
+            // which is flushed, when the sink is destroyed.
+            std::string first{}, second{};
+            std::optional<io::Tee> tee{};
+            tee.emplace(std::initializer_list<io::Tee::Sink>{ { first } });
+            print(*tee, "partial");
+            tee.emplace(std::initializer_list<io::Tee::Sink>{ { second } });
+            println(*tee, "fresh");
+            tee.reset();
+            println("staging = {} / {}", first == "partial\n", second == "fresh\n");
+        }
+
+        {
+            // An output, that prints to the Tee again, must not clobber the line being dispatched.
+            Echo echo{};
+            std::string rest{};
+            io::Tee tee{ { echo }, { rest } };
+            echo.tee = &tee;
+            tee.println(0, "{}", "outer");
+            println("reentrant tee = {}", rest == "echo of 'outer'\nouter\n");
+        }
+#endif
+
+        {
+            std::string lines{};
+            io::PrefixFilter filter{lines, "[{thread}] {component}: "};
+            io::PrefixFilter::set_component("test");
+            print(filter, "first line\nsecond ");
+            println(filter, "{}", "line");
+            io::PrefixFilter timed{lines, "{time} {{{component}}} "};
+            println(timed, "timed");
+            const auto tid = format("[{}] ", ::gettid());
+            println("prefix = {}, time = {}", lines.starts_with(tid + "test: first line\n" + tid + "test: second line\n"), lines.ends_with("Z {test} timed\n"));
+        }
+
+        {
+            using namespace safmat::style;
+            constexpr auto warn = fg::yellow | bold | underline;
+            static_assert(warn.sgr() == "\x1b[33;1;4m");
+
+            const auto plain = format("{} {:>4}", styled("warning:", warn), styled(42, bg::red));
+            style_mode = StyleMode::always;
+            const auto colored = format("{} {:>4}", styled("warning:", warn), styled(42, bg::red));
+            style_mode = StyleMode::automatic;
+            println("styled = '{}', {} bytes of escapes", plain, colored.size() - plain.size());
+            println(stdout, "styled on stdout = {}", styled("ok", fg::green));
+
+#if SAFMAT_POSIX
+            // The terminal check is cached per file descriptor, until it is reset after redirecting it.
+            const int pty = ::posix_openpt(O_RDWR | O_NOCTTY);
+            FILE *file = std::fopen("/dev/null", "w");
+            if (pty >= 0 && file) {
+                const bool before = io::Output{file}.is_tty();
+                ::dup2(pty, ::fileno(file));
+                const bool cached = io::Output{file}.is_tty();
+                io::reset_tty_cache(::fileno(file));
+                println("redirected tty = {} -> {} -> {}", before, cached, io::Output{file}.is_tty());
+            }
+            if (file) {
+                io::reset_tty_cache(::fileno(file));
+                std::fclose(file);
+            }
+            if (pty >= 0)
+                ::close(pty);
+#endif
+        }
+
+#if SAFMAT_OUT_ZLIB
+        {
+            std::string gz{};
+            {
+                io::GzipWriter writer{gz};
+                for (int i = 0; i < 1000; ++i)
+                    println(writer, "gzip line {:>4} {}", i, "some repeated text");
+            }
+
+            std::string text(64 * 1024, '\0');
+            z_stream zs{};
+            inflateInit2(&zs, 15 + 16);
+            zs.next_in = reinterpret_cast<Bytef *>(gz.data());
+            zs.avail_in = gz.size();
+            zs.next_out = reinterpret_cast<Bytef *>(text.data());
+            zs.avail_out = text.size();
+            const bool ok = inflate(&zs, Z_FINISH) == Z_STREAM_END;
+            text.resize(zs.total_out);
+            inflateEnd(&zs);
+            println("gzip = {} -> {} bytes, ok = {}, last = {}", text.size(), gz.size(), ok, text.substr(text.size() - 30, 29));
+        }
+#endif
+
+        std::vector<std::byte> bytes{};
+        print(bytes, "{}:{}", "GET", 200);
+        println("{} bytes, {:#x}", bytes.size(), static_cast<int>(bytes.back()));
     } catch (const format_error &e) {
         println("ERROR: {}", e.what());
     }
@@ -0,0 +1,47 @@
+// Renders binary logs written by safmat::binlog::Writer as text.
+// Usage: safmat-decode [FILE]...
+#define SAFMAT_BINLOG 1
+#include <cerrno>
+#include "../safmat.hpp"
+
+static bool decode(FILE *file, const char *name) {
+    try {
+        safmat::binlog::Reader reader{file};
+        bool ok{true};
+        while (true) {
+            try {
+                if (!reader.next(stdout))
+                    return ok;
+            } catch (const safmat::binlog::record_error &e) {
+                // Skip the bad record.
+                std::fflush(stdout);
+                safmat::println(stderr, "safmat-decode: {}: {}", name, e.what());
+                ok = false;
+            }
+        }
+    } catch (const safmat::format_error &e) {
+        std::fflush(stdout);
+        safmat::println(stderr, "safmat-decode: {}: {}", name, e.what());
+        return false;
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2)
+        return decode(stdin, "<stdin>") ? 0 : 1;
+
+    int status = 0;
+    for (int i = 1; i < argc; ++i) {
+        FILE *file = std::fopen(argv[i], "rb");
+        if (!file) {
+            safmat::println(stderr, "safmat-decode: {}: {}", argv[i], std::strerror(errno));
+            status = 1;
+            continue;
+        }
+
+        if (!decode(file, argv[i]))
+            status = 1;
+        std::fclose(file);
+    }
+    return status;
+}
@@ -0,0 +1,26 @@
+// Prints the lines of ring files written by safmat::io::MmapRing in order, oldest first.
+// Usage: safmat-ring FILE...
+#define SAFMAT_OUT_MMAP 1
+#include <system_error>
+#include "../safmat.hpp"
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        safmat::println(stderr, "Usage: {} FILE...", argv[0]);
+        return 1;
+    }
+
+    int status = 0;
+    for (int i = 1; i < argc; ++i) {
+        try {
+            safmat::print("{}", safmat::io::MmapRing::recover(argv[i]));
+        } catch (const safmat::format_error &e) {
+            safmat::println(stderr, "safmat-ring: {}: {}", argv[i], e.what());
+            status = 1;
+        } catch (const std::system_error &e) {
+            safmat::println(stderr, "safmat-ring: {}: {}", argv[i], e.what());
+            status = 1;
+        }
+    }
+    return status;
+}